@@ -1,9 +1,10 @@
 #pragma once
 
 #include "Core.hpp"
+#include "HeapProfiler.hpp"
 
 #if defined(CORE_OS_WINDOWS)
-#include <bit> // required for std::countr_zero()
+#include <bit> // required for std::countr_zero() and std::bit_width()
 #endif
 
 namespace core
@@ -14,22 +15,21 @@ enum class AllocDetails : uint32_t
     // Size in bytes of the allocation
     SIZE,
     // Address of next free allocation of the same size
+    // Also used as the next link by IAllocatedList (PREV must come right after this).
     // Can be used for something else while the memory is allocated -
     // make sure to reset the value to zero before freeing though
     // The address points to the usable location, so to get AllocDetail from there,
     // you must do: (char*)loc - sizeof(AllocDetail)
     NEXT,
-    // <Unused internally as of now>
+    // Used as the previous link by IAllocatedList.
     // Can be used for something else while the memory is allocated -
     // make sure to reset the value to zero before freeing though
     // The address points to the usable location, so to get AllocDetail from there,
     // you must do: (char*)loc - sizeof(AllocDetail)
     PREV,
-    // <Unused internally as of now>
-    // Can be used for something else while the memory is allocated -
-    // make sure to reset the value to zero before freeing though
-    // The address points to the usable location, so to get AllocDetail from there,
-    // you must do: (char*)loc - sizeof(AllocDetail)
+    // Address of the MemPool from which the allocation was made (along with the alignment of
+    // the allocation), or the start of the memory for allocations not made from pools.
+    // Used internally - must not be modified.
     DATA,
 
     _LAST,
@@ -37,8 +37,16 @@ enum class AllocDetails : uint32_t
 
 using AllocDetail = size_t[static_cast<uint32_t>(AllocDetails::_LAST)];
 
-constexpr size_t MAX_ROUNDUP        = 2048;
+struct MemArena;
+struct PersistentHeader;
+
+// Allocations (including their AllocDetail) larger than this are not rounded up to a size class,
+// and are never made from the pools.
+constexpr size_t MAX_ROUNDUP        = 1024 * 1024;
 constexpr size_t DEFAULT_POOL_SIZE  = 8 * 1024;
+// Each new pool of an arena is twice the size of the previous one, up to this (or the pool size
+// of the manager, if that is larger).
+constexpr size_t MAX_POOL_SIZE      = 1024 * 1024;
 constexpr size_t MAX_ALIGNMENT      = alignof(std::max_align_t);
 constexpr size_t ALLOC_DETAIL_BYTES = sizeof(AllocDetail);
 
@@ -48,10 +56,306 @@ constexpr size_t ALLOC_DETAIL_BYTES = sizeof(AllocDetail);
 static_assert(ALLOC_DETAIL_BYTES % MAX_ALIGNMENT == 0,
               "sizeof(AllocDetail) must be a multiple of max alignment");
 
+// Size classes are MAX_ALIGNMENT bytes apart up to SIZE_CLASS_STEP, after which there are four
+// classes for every doubling of size. So, at most 25% of an allocation is lost to rounding up
+// (as opposed to 50% with power of two classes).
+constexpr size_t SIZE_CLASS_STEP  = 4 * MAX_ALIGNMENT;
+constexpr size_t SIZE_CLASS_COUNT =
+    4 + 4 * (std::countr_zero(MAX_ROUNDUP) - std::countr_zero(SIZE_CLASS_STEP));
+
+// Computes the size class of sz (> 0) - use getSizeClass() instead.
+constexpr size_t calcSizeClass(size_t sz)
+{
+    if(sz <= SIZE_CLASS_STEP) return (sz - 1) / MAX_ALIGNMENT;
+    size_t v = sz - 1;
+    size_t k = std::bit_width(v) - 1; // 2^k <= v < 2^(k+1)
+    return 4 + 4 * (k - std::countr_zero(SIZE_CLASS_STEP)) + ((v >> (k - 2)) & 3);
+}
+// Size in bytes of the size class idx - use SIZE_CLASSES instead (unless idx is beyond that).
+constexpr size_t calcClassSize(size_t idx)
+{
+    if(idx < 4) return (idx + 1) * MAX_ALIGNMENT;
+    size_t base = SIZE_CLASS_STEP << ((idx - 4) / 4);
+    return base + (idx % 4 + 1) * (base / 4);
+}
+constexpr Array<size_t, SIZE_CLASS_COUNT> makeSizeClasses()
+{
+    Array<size_t, SIZE_CLASS_COUNT> res{};
+    for(size_t i = 0; i < SIZE_CLASS_COUNT; ++i) res[i] = calcClassSize(i);
+    return res;
+}
+
+// Size in bytes of each size class.
+constexpr Array<size_t, SIZE_CLASS_COUNT> SIZE_CLASSES = makeSizeClasses();
+
+// Sizes up to this are mapped to their size class using SIZE_CLASS_LUT.
+constexpr size_t SIZE_CLASS_LUT_MAX = 1024;
+
+constexpr Array<uint8_t, SIZE_CLASS_LUT_MAX / MAX_ALIGNMENT + 1> makeSizeClassLUT()
+{
+    Array<uint8_t, SIZE_CLASS_LUT_MAX / MAX_ALIGNMENT + 1> res{};
+    for(size_t i = 1; i < res.size(); ++i) res[i] = calcSizeClass(i * MAX_ALIGNMENT);
+    return res;
+}
+
+// Size class of each multiple of MAX_ALIGNMENT up to SIZE_CLASS_LUT_MAX.
+// Works since all the class sizes are multiples of MAX_ALIGNMENT.
+constexpr Array<uint8_t, SIZE_CLASS_LUT_MAX / MAX_ALIGNMENT + 1> SIZE_CLASS_LUT =
+    makeSizeClassLUT();
+
+static_assert(SIZE_CLASSES.back() == MAX_ROUNDUP, "last size class must be MAX_ROUNDUP");
+static_assert(calcSizeClass(MAX_ROUNDUP) == SIZE_CLASS_COUNT - 1, "invalid size class count");
+
+// Index of the smallest size class which can hold sz bytes. sz must be <= MAX_ROUNDUP.
+inline size_t getSizeClass(size_t sz)
+{
+    if(sz <= SIZE_CLASS_LUT_MAX) return SIZE_CLASS_LUT[(sz + MAX_ALIGNMENT - 1) / MAX_ALIGNMENT];
+    return calcSizeClass(sz);
+}
+
+// Allocations not made from the pools (see MemoryManager::isLargeAlloc()) use the size classes
+// beyond MAX_ROUNDUP as well, so that freed ones can be cached and reused.
+constexpr size_t LARGE_CLASS_COUNT = calcSizeClass(size_t(1) << (sizeof(size_t) * 8 - 1)) + 1;
+// Size of the largest large size class - allocations which don't fit in it fail.
+constexpr size_t MAX_LARGE_CLASS_SIZE = calcClassSize(LARGE_CLASS_COUNT - 1);
+// Large allocations of at least this size are mapped directly from the OS (instead of malloc).
+constexpr size_t LARGE_MMAP_MIN = 256 * 1024;
+// Mapped allocations of at least this size are aligned to it and backed by huge pages if possible.
+constexpr size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+// Most bytes of freed large allocations that a manager holds on to by default.
+constexpr size_t DEFAULT_LARGE_CACHE_LIMIT = 64 * 1024 * 1024;
+
+// Address at which persistent managers map their file by default. It must be the same every time a
+// file is mapped, since the allocations in it point to each other (and their pools). Chosen to be
+// far from where the OS (and the sanitizers) usually map anything.
+constexpr size_t DEFAULT_PERSISTENT_BASE = sizeof(void *) == 8 ? 0x7e8000000000 : 0x40000000;
+// Roots of a persistent manager, see MemoryManager::setRoot().
+constexpr size_t MAX_PERSISTENT_ROOTS = 64;
+constexpr size_t MAX_ROOT_NAME_CHARS  = 55;
+
+// Allocations with a larger alignment than this are never made from the pools.
+constexpr size_t MAX_POOL_ALIGNMENT = 256;
+// Alignment classes are the powers of two from MAX_ALIGNMENT to MAX_POOL_ALIGNMENT.
+// Pooled allocations of each alignment class have their own free chunk lists.
+constexpr size_t ALIGN_CLASS_COUNT =
+    std::countr_zero(MAX_POOL_ALIGNMENT) - std::countr_zero(MAX_ALIGNMENT) + 1;
+
+// align must be a power of two, <= MAX_POOL_ALIGNMENT.
+inline size_t getAlignClass(size_t align)
+{
+    if(align <= MAX_ALIGNMENT) return 0;
+    return std::countr_zero(align) - std::countr_zero(MAX_ALIGNMENT);
+}
+
+namespace MemFlags
+{
+enum MemFlags : uint32_t
+{
+    NONE = 0,
+    // All threads share a single arena instead of having one each.
+    // Its free chunk lists are lock-free (ABA-safe) stacks and its pools are carved using an
+    // atomic bump pointer, so allocations and frees never wait on a lock (except when a new pool
+    // is required).
+    LOCK_FREE = 1 << 0,
+    // Allocations of up to SLAB_MAX_OBJECT bytes are made from slabs, without any AllocDetail.
+    // Their details are kept per slab instead, which is found by masking the allocation's address.
+    // getAllocDetail()/setAllocDetail() must not be used in this mode, and IAllocatedList can only
+    // contain allocations made through a list (see MemoryManager::allocListRaw()).
+    // Ignored in LOCK_FREE mode.
+    SLABS = 1 << 1,
+};
+} // namespace MemFlags
+
 struct MemPool
 {
-    char *head;
+    // Only modified atomically (fetch_add) in MemFlags::LOCK_FREE mode.
+    Atomic<char *> head;
     char *mem;
+    size_t size;
+    MemArena *arena;
+    // Allocations from the pool which haven't been freed yet (not counted in MemFlags::LOCK_FREE
+    // mode). Only modified by the owner of the arena, atomic for MemoryManager::heapMap().
+    Atomic<size_t> live;
+
+    MemPool(char *mem, size_t size, MemArena *arena);
+};
+
+// Slabs are page sized, and must be aligned to their size.
+constexpr size_t SLAB_SIZE       = 4096;
+constexpr size_t SLAB_MAX_OBJECT = 512;
+// Slab objects are aligned to the largest power of two (up to this) which divides their size, so
+// over-aligned allocations just use a size class which is a multiple of their alignment.
+constexpr size_t SLAB_MAX_ALIGNMENT = 64;
+// Slab objects use the size classes up to SLAB_MAX_OBJECT.
+constexpr size_t SLAB_CLASSES = calcSizeClass(SLAB_MAX_OBJECT) + 1;
+// Address space reserved for the slabs of a manager. Physical memory is only used for the slabs
+// which are actually allocated.
+constexpr size_t SLAB_RESERVE = sizeof(void *) == 8 ? (size_t(1) << 32) : (size_t(64) << 20);
+// In MemFlags::SLABS mode, allocations made for an IAllocatedList from slabs have their list links
+// (next, prev) stored in these many bytes before them.
+constexpr size_t LIST_LINK_BYTES = 2 * sizeof(size_t);
+
+static_assert(LIST_LINK_BYTES % MAX_ALIGNMENT == 0,
+              "list links must be a multiple of max alignment");
+
+// Stored at the beginning of each slab (MemFlags::SLABS mode).
+struct MemSlab
+{
+    MemArena *arena;
+    // Adjacent slabs (of the same class) with free objects in the arena.
+    MemSlab *next;
+    MemSlab *prev;
+    // Freed objects, linked through their first word.
+    char *freeObj;
+    // Objects after this have never been allocated.
+    char *bump;
+    uint32_t objSize;
+    uint32_t classIdx;
+    uint32_t used;
+    // Set if the slab is in its arena's slab list.
+    bool listed;
+};
+
+constexpr size_t SLAB_HEADER_BYTES =
+    (sizeof(MemSlab) + SLAB_MAX_ALIGNMENT - 1) & ~(SLAB_MAX_ALIGNMENT - 1);
+
+// Allocation counters of a single thread, summed up by MemoryManager::stats().
+// They are only modified by the owner of the arena they belong to, so updating them needs no
+// atomic read-modify-write. They are atomics anyway, since stats() reads them from other threads.
+struct MemCounters
+{
+    Atomic<size_t> allocCount;
+    Atomic<size_t> freeCount;
+    Atomic<size_t> reuseCount;
+    Atomic<size_t> requestedBytes;
+    Atomic<size_t> allocBytes;
+    Atomic<size_t> freedBytes;
+    // For each size class. Chunks may be taken from a free list by a thread other than the one
+    // which put them there (MemFlags::LOCK_FREE mode), so only the sum over all threads is valid.
+    Array<Atomic<size_t>, SIZE_CLASS_COUNT> classAllocs;
+    Array<Atomic<size_t>, SIZE_CLASS_COUNT> classFrees;
+    Array<Atomic<size_t>, SIZE_CLASS_COUNT> classFreeChunks;
+
+    MemCounters();
+};
+
+struct MemSizeClassStats
+{
+    size_t allocCount;
+    size_t freeCount;
+    // Chunks of the class in the free chunk lists.
+    size_t freeChunks;
+};
+
+// Snapshot of the counters of a MemoryManager, see MemoryManager::stats().
+struct MemStats
+{
+    size_t allocCount;
+    size_t freeCount;
+    // Allocations served from free chunk lists, freed slab objects or the large allocation cache.
+    size_t reuseCount;
+    // Bytes asked for by allocRaw() callers.
+    size_t requestedBytes;
+    // Bytes used up for allocations (including rounding up to the size class and the AllocDetail).
+    size_t allocBytes;
+    size_t freedBytes;
+    size_t liveBytes;
+    // Bytes obtained from the OS (pools, slabs, large allocations and the large allocation cache),
+    // currently and at most.
+    size_t osBytes;
+    size_t peakOsBytes;
+    size_t largeCacheBytes;
+    size_t poolCount;
+    size_t arenaCount;
+    size_t slabCount;
+    // Large allocations are not included in these.
+    Array<MemSizeClassStats, SIZE_CLASS_COUNT> sizeClasses;
+};
+
+enum class HeapMapFormat
+{
+    JSON,
+    // Little endian, all integers are 64 bit (doubles are stored as their bits):
+    // "LCHM", version (32 bit), slabCount, slabBytes, largeCacheBytes, fragmentation,
+    // class count, then for each class: size, allocCount, freeCount, freeChunks,
+    // arena count, then for each arena: owned, fragmentation, one freeChunks per class,
+    // pool count, then for each pool: address, size, used, live.
+    BINARY,
+};
+
+constexpr uint32_t HEAP_MAP_VERSION = 1;
+
+struct HeapPoolInfo
+{
+    size_t address;
+    size_t size;
+    // Bytes carved so far (the bump offset).
+    size_t used;
+    // Allocations which haven't been freed yet (not counted in MemFlags::LOCK_FREE mode).
+    size_t live;
+};
+
+struct HeapArenaInfo
+{
+    bool owned;
+    // Share of the carved pool bytes which is sitting in the free chunk lists.
+    double fragmentation;
+    // Length of the free chunk lists of each size class. Chunks may be taken from a free list by
+    // another thread in MemFlags::LOCK_FREE mode, so only the sum over all arenas is valid there.
+    Array<size_t, SIZE_CLASS_COUNT> freeChunks;
+    Vector<HeapPoolInfo> pools;
+};
+
+// Layout of the heap of a MemoryManager, see MemoryManager::heapMap().
+struct HeapMap
+{
+    size_t slabCount;
+    size_t slabBytes;
+    size_t largeCacheBytes;
+    // Share of the memory backing pooled and slab allocations (carved pool bytes and slabs) which
+    // isn't holding live allocations - lost to free chunks, rounding up and partly used slabs.
+    double fragmentation;
+    Array<MemSizeClassStats, SIZE_CLASS_COUNT> sizeClasses;
+    Vector<HeapArenaInfo> arenas;
+};
+
+// A set of pools and free chunk lists which is owned by at most one thread at a time.
+// The owning thread allocates from, and frees to, the arena without taking any lock.
+// Allocations freed by other threads are handed back to the arena via remoteFree instead.
+// Aligned to a cache line so that arenas of different threads don't share one.
+struct alignas(64) MemArena
+{
+    // Free chunk lists for each alignment class and size class.
+    Array<Array<size_t, SIZE_CLASS_COUNT>, ALIGN_CLASS_COUNT> freechunks;
+    // Free chunk lists used in MemFlags::LOCK_FREE mode instead of freechunks.
+    // Each one is a Treiber stack whose head is a tagged pointer (see MemoryManager::pushChunk()).
+    Array<Array<Atomic<uint64_t>, SIZE_CLASS_COUNT>, ALIGN_CLASS_COUNT> sharedchunks;
+    // Only the last one (current) is used for allocations.
+    Vector<MemPool *> pools;
+    // Slabs with free objects, for each slab class.
+    Array<MemSlab *, SLAB_CLASSES> slabs;
+    // Slabs without any allocations (which are not kept in slabs), linked through MemSlab::next.
+    MemSlab *emptySlabs;
+    // The pool being carved. Once it runs out, its leftover space is put in the free chunk lists
+    // (except in MemFlags::LOCK_FREE mode) and a new, larger pool replaces it.
+    Atomic<MemPool *> current;
+    // Allocations freed by threads which do not own this arena, linked via AllocDetails::NEXT
+    // (or via their first word for slab allocations). A lock-free stack which other threads push
+    // to, and which the owner empties all at once (when it runs out of free chunks) to move them
+    // to freechunks - so remote frees never block the owner, nor each other.
+    Atomic<size_t> remoteFree;
+    // Guards pools (when not accessed by the owner).
+    Mutex mtx;
+    // Set while a thread owns this arena. Cleared when the thread exits.
+    Atomic<bool> owned;
+    // Set by MemoryManager::trim() for the owner to trim the arena on its next allocation.
+    Atomic<bool> trimRequested;
+    // Counters of the owner - in MemFlags::LOCK_FREE mode, threads still own arenas for these.
+    MemCounters counters;
+    // Bytes the owner allocates until its next heap profile sample, see HeapProfiler::onAlloc().
+    size_t sampleCountdown;
+
+    MemArena();
 };
 
 // Base class for anything that uses the memory manager / allocator
@@ -64,34 +368,199 @@ public:
 
 template<typename T> concept IAllocatedDerived = std::is_base_of_v<IAllocated, T>;
 
+class MemoryManager;
+
+// std::pmr::memory_resource which allocates from a MemoryManager, for the core::pmr containers.
+class MemResource : public std::pmr::memory_resource
+{
+    MemoryManager &mem;
+
+    void *do_allocate(size_t bytes, size_t align) override;
+    void do_deallocate(void *p, size_t bytes, size_t align) override;
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override;
+
+public:
+    MemResource(MemoryManager &mem);
+
+    inline MemoryManager &getMemoryManager() { return mem; }
+};
+
 class MemoryManager
 {
-    // The size_t at freechunks[sz] is an address which holds an allocation.
-    // This address is after ALLOC_DETAIL_BYTES bytes.
-    Array<size_t, std::countr_zero(MAX_ROUNDUP)> freechunks;
-    Vector<MemPool> pools;
-    // TODO: have multiple arenas and then use mutexes individual to those arenas
-    // then, in a mutithreaded environment, the manager should be able to choose one of the
-    // available arenas and allocate memory from that (therefore increasing speed, compared to a
-    // global mutex).
-    RecursiveMutex mtx;
+    // Each thread that uses the manager gets its own arena. Arenas of exited threads are reused
+    // by new threads.
+    Vector<MemArena *> arenas;
+    // Guards arenas.
+    Mutex arenasMtx;
     String name;
+    // Size of the first pool of each arena.
     size_t poolSize;
-
-    inline constexpr size_t getFreeChunkIndex(size_t sz) { return std::countr_zero(sz) - 1; }
-    // works upto MAX_ROUNDUP
-    size_t nextPow2(size_t sz);
-    void allocPool();
+    // Unique for every manager instance (never reused), used to look up the arena of a thread.
+    size_t id;
+    uint32_t flags;
+    // The only arena in MemFlags::LOCK_FREE mode.
+    MemArena *sharedArena;
+    // Address space reserved for slabs (MemFlags::SLABS mode), both nullptr otherwise.
+    char *slabBegin;
+    char *slabEnd;
+    // Bytes of slabBegin which have been handed out to arenas as slabs.
+    Atomic<size_t> slabsUsed;
+    // Freed large allocations of each size class, linked via their first word.
+    Array<char *, LARGE_CLASS_COUNT> largeCache;
+    // Bytes held in largeCache, and the most it may hold.
+    size_t largeCacheBytes;
+    size_t largeCacheLimit;
+    // Guards largeCache. Large allocations are expensive enough anyway for a lock to not matter.
+    Mutex largeCacheMtx;
+    // Empty slabs given back to the OS by trim(), reused before any new slab is taken.
+    Vector<MemSlab *> purgedSlabs;
+    Atomic<size_t> purgedSlabCount;
+    Mutex purgedSlabsMtx;
+    // Calls trim() periodically, see setTrimInterval().
+    JThread trimThread;
+    // Bytes obtained from the OS, see MemStats. Only updated when pools, slabs or large
+    // allocations are obtained or released.
+    Atomic<size_t> osBytes;
+    Atomic<size_t> peakOsBytes;
+    // nullptr until sampling is enabled by setSampleInterval(), kept until destruction after that.
+    Atomic<HeapProfiler *> profiler;
+    // Start of the mapped file of a persistent manager, nullptr otherwise.
+    PersistentHeader *persistent;
+    // Guards the carving of the file and its roots.
+    Mutex persistentMtx;
+    MemResource resource;
+
+    // file is nullptr for managers which aren't persistent.
+    MemoryManager(StringRef name, size_t poolSize, uint32_t flags, const Path *file,
+                  size_t capacity, size_t base);
+
+    // Allocations of size (including AllocDetail) larger than this are not made from the pools.
+    inline bool isLargeAlloc(size_t allocSz) { return allocSz > poolSize || allocSz > MAX_ROUNDUP; }
+    // Makes a new pool the current one of the arena. Returns nullptr if a persistent manager's
+    // file is full.
+    // arena.mtx must be locked by the caller.
+    MemPool *allocPool(MemArena &arena);
+    // Puts the given memory of the pool in the free chunk lists of its arena.
+    void addFreeChunks(MemPool *pool, char *mem, size_t bytes);
+    // Puts the rest of the pool in the free chunk lists of its arena, so that it isn't carved
+    // anymore - must be called by the owner of the arena.
+    void retirePool(MemPool *pool);
+
+    // Returns the arena owned by the calling thread, or nullptr if it doesn't own one yet.
+    MemArena *getThreadArena();
+    // Returns the arena owned by the calling thread, adopting (or creating) one if required.
+    // If borrowed is set, the (exiting) thread must give up the arena once it is done with it.
+    MemArena *acquireThreadArena(bool &borrowed);
+    void addOsBytes(size_t bytes);
+    void subOsBytes(size_t bytes);
+    // Fills out with allocations, see allocBatch(). If useSlab is false, they are never made from
+    // a slab.
+    size_t allocRawImpl(size_t size, size_t align, bool useSlab, Span<void *> out);
+    // Fills out with allocations of allocSz bytes (including ALLOC_DETAIL_BYTES) from the arena.
+    // Returns the number of allocations made, which is less than out.size() only if a persistent
+    // manager's file is full.
+    size_t allocFromArena(MemArena &arena, size_t allocSz, size_t alignIdx, Span<void *> out);
+    // Puts a pooled allocation in the free chunk list of its arena - must be called by the owner
+    // of arena.
+    void freeToArena(MemArena &arena, char *loc);
+    // Carves allocSz bytes from the pool such that the allocation (after ALLOC_DETAIL_BYTES) is
+    // aligned to align. Returns nullptr if the pool doesn't have enough space left.
+    char *carvePool(MemPool *pool, size_t allocSz, size_t align);
+    // Allocations which are too large (or too aligned) for the pools.
+    // allocSz includes ALLOC_DETAIL_BYTES.
+    char *allocLarge(size_t allocSz, size_t align, MemCounters &counters);
+    void freeLarge(char *loc);
+    // Grows a large allocation by remapping its block. Returns nullptr if that isn't possible.
+    char *remapLarge(char *loc, size_t newSize);
+    // Grows a pooled allocation in place if it is the last one carved from the current pool of the
+    // calling thread, and the pool has enough space left.
+    bool growInPool(char *loc, size_t newSize);
+    // Moves the heap profile sample (if any) of an allocation resized by reallocRaw() without
+    // allocRaw(), to newLoc and newSize. Returns newLoc.
+    char *resizeSample(char *loc, char *newLoc, size_t newSize);
+    // Gets memory for a large allocation from the OS (or malloc, for smaller sizes).
+    char *mapLarge(size_t blockSz, size_t align);
+    void unmapLarge(char *block, size_t blockSz);
+    // Gives cached large allocations back to the OS until at most keepBytes are cached.
+    // largeCacheMtx must be locked by the caller.
+    void releaseLargeCache(size_t keepBytes);
+    // Moves the remotely freed allocations of the arena into its free chunk lists.
+    // Returns false if there was nothing to move.
+    bool collectRemoteFree(MemArena &arena);
+    // Pushes a chain of allocations (head to tail, linked the same way as remoteFree) to the
+    // remote free list of the arena.
+    void pushRemoteFree(MemArena &arena, size_t head, size_t tail);
+    // Link of an allocation in a remote free list.
+    inline void setRemoteNext(size_t alloc, size_t next)
+    {
+        if(isSlabAlloc((void *)alloc)) *(size_t *)alloc = next;
+        else setAllocDetail(alloc, AllocDetails::NEXT, next);
+    }
+    // Releases the empty pools and slabs of the arena - must be called by the owner of arena.
+    // Returns the number of bytes released.
+    size_t trimArena(MemArena &arena);
+
+    // Persistent managers
+    // Maps the file, creating it if required. Returns false if it cannot be used.
+    bool openPersistent(const Path &file, size_t capacity, size_t base);
+    // Takes over the pools, free chunk lists and large allocation cache saved in the file.
+    void adoptPersistent();
+    // Saves the state of the heap to the file and unmaps it.
+    void closePersistent();
+    // Carves bytes from the file. Returns nullptr if the file is full.
+    char *carvePersistent(size_t bytes, size_t align);
+
+    // MemFlags::SLABS mode
+    // Returns nullptr if the slab address space has run out.
+    char *allocSlab(MemArena &arena, size_t size, size_t align);
+    MemSlab *newSlab(MemArena &arena, size_t classIdx);
+    void freeSlab(char *obj);
+    // Puts the object back in its slab - must be called by the owner of arena.
+    void releaseSlabObject(MemArena &arena, char *obj);
+
+    // MemFlags::LOCK_FREE mode
+    char *allocLockFree(MemArena &arena, size_t allocSz, size_t alignIdx, MemCounters &counters);
+    void pushChunk(Atomic<uint64_t> &head, size_t chunk);
+    size_t popChunk(Atomic<uint64_t> &head);
 
 public:
-    MemoryManager(StringRef name, size_t poolSize = DEFAULT_POOL_SIZE);
+    MemoryManager(StringRef name, size_t poolSize = DEFAULT_POOL_SIZE,
+                  uint32_t flags = MemFlags::NONE);
+    // Persistent manager, whose pools and large allocations are carved from a file of capacity
+    // bytes, mapped at base. Destroying the manager saves the state of its heap in the file, so a
+    // manager which opens the file later on (in this process or another one) finds all the
+    // allocations which weren't freed, along with the roots set for them (see setRoot()). The
+    // capacity and base of an existing file are the ones it was created with.
+    // Allocations in the file must not point outside of it. Objects with virtual functions are
+    // best not stored there, as their vtables move between builds (and runs, for PIE binaries).
+    // If the file cannot be mapped at base, the manager is not persistent (see isPersistent()).
+    MemoryManager(StringRef name, const Path &file, size_t capacity,
+                  size_t poolSize = DEFAULT_POOL_SIZE, size_t base = DEFAULT_PERSISTENT_BASE);
     ~MemoryManager();
 
+    // align must be a power of two. Allocations aligned to more than MAX_POOL_ALIGNMENT are not made
+    // from the pools.
     void *allocRaw(size_t size, size_t align);
     void freeRaw(void *data);
-
-    // Helper function - only use if seeing memory issues.
-    void dumpMem(char *pool);
+    // Same as calling allocRaw() for each element of out, but the arena is looked up only once and
+    // pooled allocations are taken off their free chunk list together.
+    // Returns the number of allocations made - the rest of out is set to nullptr.
+    size_t allocBatch(size_t size, size_t align, Span<void *> out);
+    // Same as calling freeRaw() for each element of allocs, but allocations belonging to other
+    // threads' arenas are handed back to each arena as a single chain.
+    void freeBatch(Span<void *> allocs);
+    // Resizes the allocation to newSize bytes, keeping its contents and alignment. This is done in
+    // place if its size class has room, or if it is the last allocation carved from the calling
+    // thread's current pool. Large allocations are remapped where the OS supports it. Otherwise,
+    // the contents are moved to a new allocation.
+    // data may be nullptr, and a newSize of 0 frees it. Must not be used on allocations made by
+    // allocListRaw(). Returns nullptr (leaving data as it is) on failure.
+    void *reallocRaw(void *data, size_t newSize);
+
+    // Walks the arenas and their pools. Each arena is only locked while its pools are listed, and
+    // the counters of other threads may be slightly out of date (see stats()).
+    HeapMap heapMap();
+    bool writeHeapMap(OStream &os, HeapMapFormat format);
 
     template<IAllocatedDerived T, typename... Args> T *allocInit(Args &&...args)
     {
@@ -104,6 +573,47 @@ public:
         freeRaw(data);
     }
 
+    // Allocations to be added to an IAllocatedList must be made (and freed) using these.
+    // Unless in MemFlags::SLABS mode, these are the same as allocRaw() and freeRaw().
+    // Allocations from slabs reserve space for the list links before them, as they don't have
+    // an AllocDetail.
+    void *allocListRaw(size_t size, size_t align);
+    void freeListRaw(void *data);
+    // freeBatch() for allocations made by allocListRaw(). Overwrites the elements of allocs.
+    void freeListBatch(Span<void *> allocs);
+    template<IAllocatedDerived T, typename... Args> T *allocListInit(Args &&...args)
+    {
+        void *m = allocListRaw(sizeof(T), alignof(T));
+        return new(m) T(std::forward<Args>(args)...);
+    }
+    inline void freeListDeinit(IAllocated *data)
+    {
+        data->~IAllocated();
+        freeListRaw(data);
+    }
+    // The list links (next, prev) of an allocation made by allocListRaw().
+    inline size_t *getListLinks(void *alloc)
+    {
+        if(isSlabAlloc(alloc)) return (size_t *)((char *)alloc - LIST_LINK_BYTES);
+        return &(*(AllocDetail *)((char *)alloc - ALLOC_DETAIL_BYTES))[static_cast<uint32_t>(
+            AllocDetails::NEXT)];
+    }
+
+    inline bool isSlabAlloc(void *alloc) { return alloc >= slabBegin && alloc < slabEnd; }
+    inline bool isPersistent() { return persistent; }
+
+    // Named allocations of a persistent manager, by which the heap is found again after reopening
+    // its file. Setting a root to nullptr removes it. Returns false if the manager isn't
+    // persistent, the name is empty or too long (see MAX_ROOT_NAME_CHARS), or all the roots are
+    // used up.
+    bool setRoot(StringRef name, void *alloc);
+    // nullptr if there is no such root.
+    void *getRoot(StringRef name);
+    // Flushes the file of a persistent manager. The free chunk lists are only saved when the
+    // manager is destroyed - if the process dies before that, the next manager to open the file
+    // finds the allocations made up to the last sync(), but not the free memory in its pools.
+    bool sync();
+
     // alloc address must be AFTER sizeof(AllocDetail)
     inline void setAllocDetail(size_t alloc, AllocDetails field, size_t value)
     {
@@ -117,13 +627,110 @@ public:
     }
 
     inline size_t getPoolSize() { return poolSize; }
-    inline size_t getPoolCount() { return pools.size(); }
+    // For the core::pmr containers, so that their buffers come from this manager.
+    inline MemResource &getResource() { return resource; }
+    inline size_t getSlabCount() { return std::min(slabsUsed.load(), SLAB_RESERVE) / SLAB_SIZE; }
+    inline uint32_t getFlags() { return flags; }
+    size_t getPoolCount();
+    size_t getArenaCount();
+    // Can be called at any time from any thread. The counters of other threads may be slightly
+    // out of date, and allocations freed by a thread which doesn't own their arena are only
+    // counted once the owner collects them.
+    MemStats stats();
+    // Freed large allocations are cached for reuse as long as the cache stays within the limit.
+    void setLargeCacheLimit(size_t bytes);
+    size_t getLargeCacheBytes();
+
+    // Gives memory which isn't in use back to the OS: empty pools, empty slabs and cached large
+    // allocations. Arenas owned by other threads are trimmed by their owners on their next
+    // allocation from them. Pools of MemFlags::LOCK_FREE managers are never released, since other
+    // threads may be reading the chunks in them at any time. Persistent managers release nothing,
+    // as all of their memory belongs to the file.
+    // Returns the number of bytes released right away.
+    size_t trim();
+    // Calls trim() from a background thread every interval. Zero stops it.
+    void setTrimInterval(std::chrono::milliseconds interval);
+
+    // Enables the heap profiler, which samples an allocation every bytes (on average) and records
+    // its stack trace. Zero stops sampling - allocations sampled already are still tracked.
+    // Sampled allocations resized by reallocRaw() stay tracked, at their new size and address.
+    void setSampleInterval(size_t bytes);
+    // nullptr if sampling has never been enabled.
+    inline HeapProfiler *getProfiler() { return profiler.load(std::memory_order_acquire); }
+    // Writes the sampled allocations which are still live. Returns false if sampling has never
+    // been enabled (or the stream fails).
+    bool writeProfile(OStream &os, ProfileFormat format);
+};
+
+// Standard allocator which allocates from a MemoryManager, for containers which don't take a
+// memory_resource.
+template<typename T> class ManagedAllocator
+{
+    MemoryManager *mem;
+
+    template<typename U> friend class ManagedAllocator;
+
+public:
+    using value_type = T;
+
+    ManagedAllocator(MemoryManager &mem) noexcept : mem(&mem) {}
+    template<typename U> ManagedAllocator(const ManagedAllocator<U> &other) noexcept : mem(other.mem)
+    {}
+
+    T *allocate(size_t n)
+    {
+        if(n > SIZE_MAX / sizeof(T)) throw std::bad_array_new_length();
+        T *res = (T *)mem->allocRaw(std::max(n * sizeof(T), size_t(1)), alignof(T));
+        if(!res) throw std::bad_alloc();
+        return res;
+    }
+    void deallocate(T *p, size_t) noexcept { mem->freeRaw(p); }
+
+    inline MemoryManager &getMemoryManager() const { return *mem; }
+
+    template<typename U> bool operator==(const ManagedAllocator<U> &other) const noexcept
+    {
+        return mem == other.mem;
+    }
+};
+
+// Positional index of an indexed IAllocatedList.
+// Allocations are kept in slots in list order, along with a Fenwick tree of the used slots, so the
+// allocation at an index is found in O(log n). Removed allocations leave their slot empty until
+// half of the slots are empty, at which point the slots are compacted.
+// All of its memory comes from the MemoryManager of the list.
+class ListIndex
+{
+    template<typename T> using ManagedVector = std::vector<T, ManagedAllocator<T>>;
+
+    ManagedVector<void *> slots;
+    // 1-based - tree[i] is the number of used slots in (i - lowest set bit of i, i].
+    ManagedVector<size_t> tree;
+    std::unordered_map<void *, size_t, std::hash<void *>, std::equal_to<void *>,
+                       ManagedAllocator<std::pair<void *const, size_t>>>
+        slotOf;
+    size_t used;
+
+    void update(size_t slot, ssize_t delta);
+    void compact();
+
+public:
+    ListIndex(MemoryManager &mem);
+
+    // Allocations can only be appended, the same as in IAllocatedList.
+    void add(void *alloc);
+    void remove(void *alloc);
+    void clear();
+    // Returns nullptr if index is out of range.
+    void *at(size_t index) const;
 };
 
 class IAllocatedList : public IAllocated
 {
     String name;
     size_t count;
+    // nullptr unless the list is indexed.
+    ListIndex *index;
 
 protected:
     MemoryManager &mem;
@@ -132,42 +739,56 @@ protected:
     void *removeAlloc(size_t allocIndex, void *&start, void *&end);
 
     void *getAt(size_t index, void *start, void *end) const;
+    // Empties the list, freeing its allocations in batches (after destroying them if destroy is
+    // set). Returns the number of allocations freed.
+    size_t freeAll(void *&start, void *&end, bool destroy);
+    // Takes over the allocations linked from first, which the (empty) list didn't free before.
+    // Returns the number of allocations taken.
+    size_t adoptAll(void *first, void *&start, void *&end);
+    // Empties the list without freeing its allocations. Returns the first one.
+    void *releaseAll(void *&start, void *&end);
 
-    inline void *getPrev(void *from, void *end) const
-    {
-        return from ? (void *)mem.getAllocDetail((size_t)from, AllocDetails::PREV) : end;
-    }
-    inline void *getNext(void *from, void *start) const
-    {
-        return from ? (void *)mem.getAllocDetail((size_t)from, AllocDetails::NEXT) : start;
-    }
+    inline void *&nextOf(void *alloc) const { return (void *&)mem.getListLinks(alloc)[0]; }
+    inline void *&prevOf(void *alloc) const { return (void *&)mem.getListLinks(alloc)[1]; }
+
+    inline void *getPrev(void *from, void *end) const { return from ? prevOf(from) : end; }
+    inline void *getNext(void *from, void *start) const { return from ? nextOf(from) : start; }
 
     inline size_t getSize() const { return count; }
     inline bool isEmpty(void *start) const { return !start; }
 
 public:
-    IAllocatedList(MemoryManager &mem, String &&name);
-    IAllocatedList(MemoryManager &mem, const char *name);
+    // Indexed lists keep a ListIndex besides the links, so that accessing (or removing) the
+    // allocation at an index takes O(log n) instead of walking the list. In exchange, adding and
+    // removing allocations by pointer takes O(log n) as well instead of O(1), and each allocation
+    // costs a slot, a tree node and a hash map entry (all allocated from mem) on top of its links.
+    IAllocatedList(MemoryManager &mem, String &&name, bool indexed = false);
+    IAllocatedList(MemoryManager &mem, const char *name, bool indexed = false);
     virtual ~IAllocatedList();
 
+    IAllocatedList(const IAllocatedList &other)            = delete;
+    IAllocatedList &operator=(const IAllocatedList &other) = delete;
+
     inline StringRef getName() { return name; }
+    inline bool isIndexed() const { return index; }
 };
 
 // Cannot be a static object - as it uses the static variable `logger` in destructor.
 // RAII based - does not allow freeing of the memory unless it goes out of scope.
 // Only allocates IAllocated derived objects
+// Allocations added to the list must have been made using MemoryManager::allocListInit().
 class ManagedList : public IAllocatedList
 {
     IAllocated *start, *end;
 
 public:
-    ManagedList(MemoryManager &mem, String &&name);
-    ManagedList(MemoryManager &mem, const char *name);
+    ManagedList(MemoryManager &mem, String &&name, bool indexed = false);
+    ManagedList(MemoryManager &mem, const char *name, bool indexed = false);
     ~ManagedList();
 
     template<IAllocatedDerived T, typename... Args> T *alloc(Args &&...args)
     {
-        T *res = mem.allocInit<T>(std::forward<Args>(args)...);
+        T *res = mem.allocListInit<T>(std::forward<Args>(args)...);
         addAlloc(res, (void *&)start, (void *&)end);
         return res;
     }
@@ -212,18 +833,19 @@ public:
 // Cannot be a static object - as it uses the static variable `logger` in destructor.
 // RAII based - does not allow freeing of the memory unless it goes out of scope.
 // Only allocates raw objects - NO constructor / destructor is called
+// Allocations added to the list must have been made using MemoryManager::allocListRaw().
 class ManagedRawList : public IAllocatedList
 {
     void *start, *end;
 
 public:
-    ManagedRawList(MemoryManager &mem, String &&name);
-    ManagedRawList(MemoryManager &mem, const char *name);
+    ManagedRawList(MemoryManager &mem, String &&name, bool indexed = false);
+    ManagedRawList(MemoryManager &mem, const char *name, bool indexed = false);
     ~ManagedRawList();
 
     template<typename T> T *alloc(size_t count = 1)
     {
-        T *res = (T *)mem.allocRaw(sizeof(T) * count, alignof(T));
+        T *res = (T *)mem.allocListRaw(sizeof(T) * count, alignof(T));
         addAlloc(res, start, end);
         return res;
     }
@@ -238,6 +860,12 @@ public:
     bool free(size_t index);
 
     size_t clear();
+    // Takes over the allocations of a list whose allocations were released (see release()) - like
+    // one found through a root of a persistent manager. The list must be empty.
+    inline size_t adopt(void *first) { return adoptAll(first, start, end); }
+    // Gives up the allocations without freeing them, returning the first one (which the rest are
+    // linked from).
+    inline void *release() { return releaseAll(start, end); }
 
     inline void *add(void *alloc) { return addAlloc(alloc, start, end); }
 
@@ -0,0 +1,113 @@
+#pragma once
+
+#include "Allocator.hpp"
+
+namespace core
+{
+
+constexpr size_t DEFAULT_BUMP_BLOCK_SIZE = 4 * 1024;
+
+// Monotonic allocator on top of a MemoryManager, for short lived allocations (like the temporary
+// objects of a single request). Allocations are carved from blocks with a pointer bump, and are
+// only given back all at once - by reset(), or by rewinding to a Marker taken earlier.
+// Destructors are run (newest first) only for the objects which have a non-trivial one.
+// Blocks are never freed before the arena is destroyed, they are reused after a rewind.
+// Not thread safe.
+class BumpArena
+{
+    struct Block
+    {
+        // Blocks are kept in the order in which they are used.
+        Block *next;
+        char *end;
+    };
+    // Registered objects with non-trivial destructors, allocated in the arena itself.
+    struct Dtor
+    {
+        Dtor *prev;
+        void (*fn)(void *);
+        void *obj;
+    };
+
+    MemoryManager &mem;
+    Block *first;
+    // Block being carved, nullptr if none has been used yet.
+    Block *block;
+    char *head;
+    char *end;
+    Dtor *dtors;
+    size_t blockSize;
+
+    static constexpr size_t BLOCK_HEADER_BYTES =
+        (sizeof(Block) + MAX_ALIGNMENT - 1) & ~(MAX_ALIGNMENT - 1);
+
+    // Moves on to a block which can fit the allocation. Returns nullptr (and stays on the current
+    // block) if the MemoryManager cannot provide one.
+    void *allocSlow(size_t size, size_t align);
+    void runDtors(Dtor *until);
+
+public:
+    // Position in the arena. Rewinding to it releases everything allocated after it.
+    struct Marker
+    {
+        Block *block;
+        char *head;
+        Dtor *dtors;
+    };
+
+    // Rewinds the arena to where it was at construction, when destroyed.
+    class Scope
+    {
+        BumpArena &arena;
+        Marker marker;
+
+    public:
+        Scope(BumpArena &arena);
+        ~Scope();
+    };
+
+    BumpArena(MemoryManager &mem, size_t blockSize = DEFAULT_BUMP_BLOCK_SIZE);
+    ~BumpArena();
+
+    BumpArena(const BumpArena &other)            = delete;
+    BumpArena &operator=(const BumpArena &other) = delete;
+
+    // align must be a power of two. Returns nullptr if the MemoryManager is out of memory.
+    inline void *allocRaw(size_t size, size_t align)
+    {
+        size_t loc = ((size_t)head + align - 1) & ~(align - 1);
+        if(loc > (size_t)end || size > (size_t)end - loc) [[unlikely]]
+            return allocSlow(size, align);
+        head = (char *)loc + size;
+        return (char *)loc;
+    }
+    template<typename T, typename... Args> T *alloc(Args &&...args)
+    {
+        if constexpr(std::is_trivially_destructible_v<T>) {
+            void *loc = allocRaw(sizeof(T), alignof(T));
+            return loc ? new(loc) T(std::forward<Args>(args)...) : nullptr;
+        } else {
+            // Registered only once constructed, so that a throwing constructor leaves no entry.
+            Dtor *dtor = (Dtor *)allocRaw(sizeof(Dtor), alignof(Dtor));
+            void *loc  = dtor ? allocRaw(sizeof(T), alignof(T)) : nullptr;
+            if(!loc) return nullptr;
+            T *obj     = new(loc) T(std::forward<Args>(args)...);
+            dtor->prev = dtors;
+            dtor->fn   = [](void *obj) { ((T *)obj)->~T(); };
+            dtor->obj  = obj;
+            dtors      = dtor;
+            return obj;
+        }
+    }
+
+    inline Marker mark() const { return {block, head, dtors}; }
+    // The marker must have been taken from this arena, after the last rewind to an earlier one.
+    void rewind(const Marker &marker);
+    void reset();
+
+    inline MemoryManager &getMemoryManager() { return mem; }
+    // Bytes (including block headers) taken from the MemoryManager.
+    size_t getReservedBytes() const;
+};
+
+} // namespace core
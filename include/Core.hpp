@@ -6,6 +6,8 @@
 #include <array>
 #include <atomic>
 #include <cassert>
+#include <charconv>
+#include <condition_variable>
 #include <cstring>
 #include <deque>
 #include <filesystem>
@@ -14,12 +16,15 @@
 #include <future>
 #include <initializer_list>
 #include <iostream>
+#include <memory_resource>
 #include <mutex>
 #include <regex>
 #include <span>
 #include <string>
 #include <string_view>
 #include <thread>
+#include <tuple>
+#include <type_traits>
 #include <unordered_map>
 #include <unordered_set>
 #include <variant>
@@ -104,6 +109,7 @@ using IFStream       = std::ifstream;
 using OFStream       = std::ofstream;
 using StringRef      = std::string_view;
 using RecursiveMutex = std::recursive_mutex;
+using CondVar        = std::condition_variable_any;
 
 #if defined(CORE_OS_WINDOWS)
 using WString    = std::wstring;
@@ -135,6 +141,21 @@ template<typename T, size_t N> using Array = std::array<T, N>;
 template<typename K, typename V> using Map = std::unordered_map<K, V>;
 template<typename V> using StringMap = std::unordered_map<String, V, StringHash, std::equal_to<>>;
 
+// Same as the containers above, but they get their memory from a std::pmr::memory_resource
+// (like core::MemResource) instead of the global heap.
+namespace pmr
+{
+using String = std::pmr::string;
+
+template<typename T> using Set             = std::pmr::unordered_set<T>;
+template<typename T> using Deque           = std::pmr::deque<T>;
+template<typename T> using Vector          = std::pmr::vector<T>;
+template<typename T> using UniList         = std::pmr::forward_list<T>;
+template<typename K, typename V> using Map = std::pmr::unordered_map<K, V>;
+template<typename V>
+using StringMap = std::pmr::unordered_map<String, V, StringHash, std::equal_to<>>;
+} // namespace pmr
+
 constexpr size_t MAX_PATH_CHARS = 4096;
 constexpr size_t MAX_ENV_CHARS  = 4096;
 
@@ -0,0 +1,95 @@
+#pragma once
+
+#include "Core.hpp"
+
+namespace core
+{
+
+enum class ProfileFormat
+{
+    // gperftools' heap profile (heap_v2) text format, which pprof reads - symbolized by pprof
+    // itself, using the binaries of the mapped libraries listed in the profile.
+    PPROF,
+    // One line per call site with its live bytes, frames separated by ';' (outermost first) - the
+    // input of flamegraph.pl and friends.
+    FOLDED,
+};
+
+// Stack frames recorded per sample. Deeper stacks are cut off at the outermost frames.
+constexpr size_t MAX_PROFILE_FRAMES = 48;
+
+// Sampling heap profiler used by MemoryManager (see MemoryManager::setSampleInterval()).
+// Allocations are sampled with a probability proportional to their size, such that one sample is
+// taken for every interval bytes on average. The stack trace of each sample is recorded, and the
+// samples which haven't been freed yet are kept per call site.
+// Only the tables are locked, when a sample is taken or freed. Frees of allocations which weren't
+// sampled are filtered out without any lock.
+class HeapProfiler
+{
+    struct CallSite
+    {
+        Array<void *, MAX_PROFILE_FRAMES> frames;
+        size_t frameCount;
+        // Samples and their bytes, as recorded.
+        size_t liveCount;
+        size_t liveBytes;
+        size_t allocCount;
+        size_t allocBytes;
+        // Estimated bytes of all the allocations the live samples stand for.
+        double liveEstimate;
+    };
+    struct Sample
+    {
+        size_t site;
+        size_t size;
+        double estimate;
+    };
+
+    // Counts the live samples whose address hashes to each slot.
+    static constexpr size_t FILTER_SLOTS = 4096;
+
+    Atomic<size_t> interval;
+    Array<Atomic<uint32_t>, FILTER_SLOTS> filter;
+    // Guards sites and samples.
+    Mutex mtx;
+    Map<size_t, CallSite> sites;
+    Map<void *, Sample> samples;
+
+    static inline size_t filterSlot(void *alloc) { return ((size_t)alloc >> 4) % FILTER_SLOTS; }
+    // Bytes until the next sample, drawn from an exponential distribution with mean interval.
+    size_t nextSampleDistance(size_t interval);
+    void record(void *alloc, size_t size, size_t interval);
+    void release(void *alloc);
+    void resize(void *alloc, void *newAlloc, size_t newSize);
+    // mtx must be locked by the caller.
+    void drop(Map<void *, Sample>::iterator it);
+
+public:
+    HeapProfiler(size_t interval);
+
+    inline void setInterval(size_t bytes) { interval.store(bytes, std::memory_order_relaxed); }
+    inline size_t getInterval() const { return interval.load(std::memory_order_relaxed); }
+
+    // Called for each (batch of) allocation(s) of size bytes. countdown is the bytes left until the
+    // next sample of the calling thread, zero if it hasn't been drawn yet.
+    void onAlloc(size_t &countdown, Span<void *> allocs, size_t size);
+    inline void onFree(void *alloc)
+    {
+        if(filter[filterSlot(alloc)].load(std::memory_order_relaxed) == 0) return;
+        release(alloc);
+    }
+    // Called when an allocation is resized without being allocated again - it may have moved to
+    // newAlloc (like a remapped block).
+    inline void onResize(void *alloc, void *newAlloc, size_t newSize)
+    {
+        if(filter[filterSlot(alloc)].load(std::memory_order_relaxed) == 0) return;
+        resize(alloc, newAlloc, newSize);
+    }
+
+    // Live samples and their (estimated) bytes.
+    size_t getSampleCount();
+    size_t getLiveEstimate();
+    bool write(OStream &os, ProfileFormat format);
+};
+
+} // namespace core
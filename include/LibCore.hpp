@@ -4,11 +4,16 @@
 
 #include "Allocator.hpp"
 #include "Args.hpp"
+#include "BumpArena.hpp"
 #include "Env.hpp"
 #include "File.hpp"
+#include "HeapProfiler.hpp"
 #include "Logger.hpp"
+#include "ObjectPool.hpp"
+#include "Ref.hpp"
 #include "Result.hpp"
 #include "Utils.hpp"
+#include "VirtualMem.hpp"
 
 namespace core
 {}
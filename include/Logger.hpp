@@ -17,9 +17,220 @@ enum LogLevels
 };
 } // namespace LogLevels
 
+// Statements of the LOG_* macros whose level is more verbose than CORE_MIN_LOG_LEVEL are compiled
+// out - arguments are not even evaluated. Set through the LIBCORE_MIN_LOG_LEVEL CMake option.
+#if !defined(CORE_MIN_LOG_LEVEL)
+#define CORE_MIN_LOG_LEVEL TRACE
+#endif
+
+constexpr LogLevels::LogLevels MIN_LOG_LEVEL = LogLevels::CORE_MIN_LOG_LEVEL;
+
+constexpr bool isLogLevelCompiled(LogLevels::LogLevels lvl) { return MIN_LOG_LEVEL >= lvl; }
+
 const char *logLevelStr(LogLevels::LogLevels lvl);
 const char *logLevelColorStr(LogLevels::LogLevels lvl);
 
+// Microseconds since the epoch, as stored in log records.
+int64_t logTimeNow();
+// Writes a record the way Logger writes it to its sinks: "[time][LEVEL]: data".
+void writeLogRecord(OStream &os, LogLevels::LogLevels lvl, int64_t time, StringRef data,
+                    bool withCol);
+
+// Types of the arguments of binary log records (see Logger::setBinary()) - one for each of the
+// utils::appendToString() overloads, so that the decoded records read exactly as if they were
+// formatted right away.
+enum class LogArg : uint8_t
+{
+    BOOL,
+    CHAR,
+    UINT8,
+    UINT16,
+    INT,
+    INT64,
+    SIZE,
+    FLOAT,
+    DOUBLE,
+    // Length (32 bit) followed by the characters. Arguments of types without a LogArg of their own
+    // are formatted, and stored as strings.
+    STRING,
+};
+
+// The C++ type of each LogArg before STRING, in order.
+using LogArgTypes = std::tuple<bool, char, uint8_t, uint16_t, int, int64_t, size_t, float, double>;
+
+namespace detail
+{
+// Only used for overload resolution, which picks the same overload as utils::appendToString().
+template<LogArg tag> using LogArgTag = std::integral_constant<LogArg, tag>;
+LogArgTag<LogArg::BOOL> logArgTag(bool);
+LogArgTag<LogArg::CHAR> logArgTag(char);
+LogArgTag<LogArg::UINT8> logArgTag(uint8_t);
+LogArgTag<LogArg::UINT16> logArgTag(uint16_t);
+LogArgTag<LogArg::INT64> logArgTag(int64_t);
+LogArgTag<LogArg::SIZE> logArgTag(size_t);
+LogArgTag<LogArg::INT> logArgTag(int);
+LogArgTag<LogArg::FLOAT> logArgTag(float);
+LogArgTag<LogArg::DOUBLE> logArgTag(double);
+template<typename T> LogArgTag<LogArg::STRING> logArgTag(const T &);
+} // namespace detail
+
+template<typename T>
+constexpr LogArg LOG_ARG_TAG = decltype(detail::logArgTag(std::declval<const T &>()))::value;
+
+namespace detail
+{
+// Same, but for arguments of format strings: all integers fit INT64 or SIZE, as
+// utils::formatValue() writes them all the same way.
+template<typename T> constexpr LogArg logFormatArgTag()
+{
+    if constexpr(std::is_same_v<T, bool>) return LogArg::BOOL;
+    else if constexpr(std::is_same_v<T, char>) return LogArg::CHAR;
+    else if constexpr(std::is_integral_v<T> && std::is_signed_v<T>) return LogArg::INT64;
+    else if constexpr(std::is_integral_v<T>) return LogArg::SIZE;
+    else if constexpr(std::is_same_v<T, float>) return LogArg::FLOAT;
+    else if constexpr(std::is_same_v<T, double>) return LogArg::DOUBLE;
+    else return LogArg::STRING;
+}
+} // namespace detail
+
+template<typename T>
+constexpr LogArg LOG_FORMAT_ARG_TAG = detail::logFormatArgTag<std::remove_cvref_t<T>>();
+
+// Whether a LOG_* statement is logged.
+enum class LogSiteMode : uint8_t
+{
+    // The site hasn't been reached yet, so it isn't known to setLogSiteMode().
+    UNREGISTERED,
+    // As per the level of its logger (or category).
+    DEFAULT,
+    // Always, regardless of the level.
+    ENABLED,
+    // Never.
+    DISABLED,
+};
+
+// Static record of a LOG_* statement.
+struct LogSite
+{
+    const char *file;
+    const char *function;
+    uint32_t line;
+    LogLevels::LogLevels lvl;
+    Atomic<LogSiteMode> mode;
+    // Address of the level (of a Logger or LogCategory) the site is bound to, with the lowest bit
+    // set if the site is enabled at that level. Kept up to date by setLevel() and setLogSiteMode(),
+    // zero until the site is first reached (or once its level object is destroyed).
+    Atomic<uintptr_t> state;
+    // ID of the site in binary logs, zero until the site is first logged in binary mode.
+    Atomic<uint32_t> id;
+    // Argument types of the site, set along with id.
+    Span<const LogArg> args;
+    // Format string of LOGF_* sites, nullptr for the others.
+    const char *format;
+};
+
+// Adds the site to the table of sites (unless it is there already) with its mode as per the rules
+// given to setLogSiteMode() so far, binds it to level if it isn't bound yet, and returns whether
+// the site is enabled at level.
+bool checkLogSite(LogSite &site, Atomic<LogLevels::LogLevels> &level);
+// Sets the mode of the sites whose file and function match the patterns, in which '*' matches any
+// run of characters. File patterns are matched against both the path and the file name of the site,
+// and an empty pattern matches everything. The mode also applies to the sites which are reached
+// later on, and replaces that of an earlier call with the same patterns - or of all earlier calls,
+// if both patterns are empty.
+// Returns the number of sites which have been reached so far and match.
+size_t setLogSiteMode(StringRef filePattern, StringRef funcPattern, LogSiteMode mode);
+// Sites which have been reached so far.
+Vector<const LogSite *> getLogSites();
+
+// The whole check is a single load of the state of the site - sites are registered the first time
+// they are reached. Sites reached through another level object than the one they are bound to
+// (like a helper which takes the logger as an argument) are checked the slow way.
+template<typename LevelObj> bool isLogSiteEnabled(LogSite &site, LevelObj &levelObj)
+{
+    Atomic<LogLevels::LogLevels> &level = levelObj.getLevelVar();
+    uintptr_t state                     = site.state.load(std::memory_order_relaxed);
+    if((state & ~uintptr_t(1)) == (uintptr_t)&level) [[likely]]
+        return state & 1;
+    return checkLogSite(site, level);
+}
+
+// Gives the site an ID for binary logs (unless it has one already), and returns it.
+uint32_t registerBinaryLogSite(LogSite &site, Span<const LogArg> args);
+
+// Bytes of binary log records buffered per thread before they are written to the file.
+constexpr size_t BINARY_LOG_CHUNK = 64 * 1024;
+// Binary logs start with "LCBL" and the version (32 bit), followed by entries which each start with
+// a site ID (32 bit). Records (see putLogRecord()) have a non-zero site ID, while zero introduces
+// the definition of a site: its ID, line (32 bit), level and argument count (8 bit each), the
+// LogArg of each argument, then its file and format (as strings, the format being empty for sites
+// which just concatenate their arguments). Sites are defined before their first record.
+constexpr uint32_t BINARY_LOG_VERSION = 2;
+
+// Buffer of binary log records made by one thread at a time.
+struct BinaryLogBuffer
+{
+    Vector<char> data;
+    // Guards data, against Logger::flush() from other threads.
+    Mutex mtx;
+    // Set while a thread logs to this buffer. Cleared when the thread exits.
+    Atomic<bool> owned;
+
+    BinaryLogBuffer();
+};
+
+inline void putLogBytes(Vector<char> &buf, const void *data, size_t size)
+{
+    buf.insert(buf.end(), (const char *)data, (const char *)data + size);
+}
+inline void putLogString(Vector<char> &buf, StringRef str)
+{
+    uint32_t len = str.size();
+    putLogBytes(buf, &len, sizeof(len));
+    putLogBytes(buf, str.data(), len);
+}
+template<typename T> void putLogArg(Vector<char> &buf, const T &arg)
+{
+    constexpr LogArg tag = LOG_ARG_TAG<T>;
+    if constexpr(tag != LogArg::STRING) {
+        std::tuple_element_t<(size_t)tag, LogArgTypes> value = arg;
+        putLogBytes(buf, &value, sizeof(value));
+    } else if constexpr(std::is_convertible_v<const T &, StringRef>) {
+        putLogString(buf, arg);
+    } else {
+        putLogString(buf, utils::toString(arg));
+    }
+}
+template<typename T> void putLogFormatArg(Vector<char> &buf, const T &arg)
+{
+    constexpr LogArg tag = LOG_FORMAT_ARG_TAG<T>;
+    if constexpr(tag != LogArg::STRING) {
+        std::tuple_element_t<(size_t)tag, LogArgTypes> value = arg;
+        putLogBytes(buf, &value, sizeof(value));
+    } else if constexpr(std::is_convertible_v<const T &, StringRef>) {
+        putLogString(buf, arg);
+    } else {
+        String str;
+        utils::formatValue(str, arg);
+        putLogString(buf, str);
+    }
+}
+
+// A binary log record: site ID (32 bit), time (64 bit), then the arguments - as per
+// LOG_FORMAT_ARG_TAG if format is set, else as per LOG_ARG_TAG.
+template<bool format = false, typename... Args>
+void putLogRecord(Vector<char> &buf, uint32_t siteId, int64_t time, const Args &...args)
+{
+    putLogBytes(buf, &siteId, sizeof(siteId));
+    putLogBytes(buf, &time, sizeof(time));
+    if constexpr(format) (putLogFormatArg(buf, args), ...);
+    else (putLogArg(buf, args), ...);
+}
+
+// Turns a binary log (see Logger::setBinary()) back into text, records sorted by their time.
+// Returns false if the log is invalid (the records decoded until then are written anyway).
+bool decodeBinaryLog(IStream &in, OStream &out, bool withCol = false);
+
 struct SinkInfo
 {
     OStream *f;
@@ -37,30 +248,205 @@ struct SinkInfo
     ~SinkInfo();
 };
 
+// What an asynchronous Logger does with records when its queue is full.
+enum class LogOverflow
+{
+    // The logging thread waits for the writer thread to make room.
+    BLOCK,
+    // The record is dropped.
+    DROP,
+    // The record is dropped, and the writer thread reports the number of dropped records.
+    DROP_AND_COUNT,
+};
+
+constexpr size_t DEFAULT_LOG_QUEUE_SIZE = 4096;
+
+struct LogRecord
+{
+    LogLevels::LogLevels lvl;
+    // Microseconds since the epoch.
+    int64_t time;
+    String msg;
+};
+
+// Bounded queue of log records, which any number of threads push to and a single thread pops from
+// without locking. Each slot has a sequence number telling whether it is free for the producer of
+// its position, or ready for the consumer (Dmitry Vyukov's bounded queue).
+class LogQueue
+{
+    struct alignas(64) Slot
+    {
+        Atomic<size_t> seq;
+        LogRecord rec;
+    };
+
+    Vector<Slot> slots;
+    size_t mask;
+    // Producers claim positions by advancing tail, the consumer alone advances head.
+    alignas(64) Atomic<size_t> tail;
+    alignas(64) size_t head;
+
+public:
+    // capacity is rounded up to a power of two.
+    LogQueue(size_t capacity);
+
+    // Copies the record into a slot, whose string keeps its capacity from lap to lap. Returns false
+    // if the queue is full.
+    bool push(LogLevels::LogLevels lvl, int64_t time, StringRef msg);
+    // Consumer only. Swaps the strings of rec and the slot, so capacity circulates instead of
+    // being reallocated. Returns false if there is no record ready.
+    bool pop(LogRecord &rec);
+    // Consumer only.
+    bool empty();
+    // Records pushed so far.
+    inline size_t getPushCount() { return tail.load(std::memory_order_acquire); }
+    inline size_t getCapacity() { return slots.size(); }
+};
+
+// Per thread buffer which records are formatted into before they are written or queued.
+String &logFormatBuffer();
+
+// Writes records to its sinks, either right away on the logging thread, or (once setAsync() is
+// called) from a writer thread which the logging threads hand the formatted records to.
 class Logger
 {
     Vector<SinkInfo> sinks;
-    LogLevels::LogLevels level;
+    Atomic<LogLevels::LogLevels> level;
+    // Guards sinks, so that records from different threads don't interleave.
+    Mutex sinkMtx;
+    // Set by setAsync(), kept until destruction.
+    Atomic<LogQueue *> queue;
+    LogOverflow overflow;
+    Atomic<size_t> dropped;
+    // Records written by the writer thread, notified after each batch. Waited on by flush(), and
+    // by the logging threads blocked on a full queue.
+    Atomic<size_t> written;
+    // Set while the writer thread waits for records.
+    Atomic<bool> writerIdle;
+    JThread writer;
+    // Unique for every logger instance, used to look up the binary log buffer of a thread.
+    size_t id;
+    // Set by setBinary().
+    Atomic<bool> binary;
+    // Guards binaryOut, binarySites and binaryBuffers.
+    Mutex binaryMtx;
+    OFStream binaryOut;
+    // Sites whose definitions have been written to binaryOut.
+    size_t binarySites;
+    Vector<BinaryLogBuffer *> binaryBuffers;
 
     void logInternal(LogLevels::LogLevels lvl, StringRef data);
+    // sinkMtx must be locked by the caller.
+    void writeRecord(LogLevels::LogLevels lvl, int64_t time, StringRef data);
+    void writerLoop(std::stop_token stop);
+    void wakeWriter();
+    // Returns nullptr if the calling thread is exiting.
+    BinaryLogBuffer *getBinaryBuffer();
+    // Writes out the buffer - the owner calls this once the buffer reaches BINARY_LOG_CHUNK.
+    void flushBinaryBuffer(BinaryLogBuffer &buf);
+    // binaryMtx must be locked by the caller.
+    void writeBinaryChunk(Span<const char> chunk);
+
+    template<bool format, typename... Args> void logBinary(LogSite &site, const Args &...args)
+    {
+        static constexpr Array<LogArg, sizeof...(Args)> tags = {
+            (format ? LOG_FORMAT_ARG_TAG<Args> : LOG_ARG_TAG<Args>)...};
+        uint32_t siteId = site.id.load(std::memory_order_acquire);
+        if(siteId == 0) siteId = registerBinaryLogSite(site, tags);
+        int64_t time         = logTimeNow();
+        BinaryLogBuffer *buf = getBinaryBuffer();
+        if(!buf) {
+            // The thread is exiting, so the record is written right away.
+            Vector<char> data;
+            putLogRecord<format>(data, siteId, time, args...);
+            LockGuard<Mutex> lock(binaryMtx);
+            writeBinaryChunk(data);
+            return;
+        }
+        {
+            LockGuard<Mutex> lock(buf->mtx);
+            putLogRecord<format>(buf->data, siteId, time, args...);
+            if(buf->data.size() < BINARY_LOG_CHUNK) return;
+        }
+        flushBinaryBuffer(*buf);
+    }
 
     template<typename... Args> void log(LogLevels::LogLevels lvl, Args &&...args)
     {
         if(!isLevelLoggable(lvl)) return;
-        String res = utils::toString(std::forward<Args>(args)...);
-        logInternal(lvl, res);
+        logText(lvl, std::forward<Args>(args)...);
+    }
+    // Doesn't check the level.
+    template<typename... Args> void logText(LogLevels::LogLevels lvl, Args &&...args)
+    {
+        String &buf = logFormatBuffer();
+        buf.clear();
+        utils::appendToString(buf, std::forward<Args>(args)...);
+        logInternal(lvl, buf);
     }
 
 public:
     Logger();
+    // Writes out the queued records, if asynchronous.
+    ~Logger();
 
     bool addSinkByName(const char *name, bool withCol);
 
     inline void addSink(OStream *f, bool withCol, bool mustClose)
     {
+        LockGuard<Mutex> lock(sinkMtx);
         sinks.emplace_back(f, withCol, mustClose);
     }
 
+    // Makes the logger asynchronous: records are queued (up to queueSize of them) for a writer
+    // thread to write out, so the logging threads never wait on the sinks - except as per the
+    // overflow policy when the queue is full. FATAL records are flushed right away.
+    // Can only be done once, the writer thread runs until the logger is destroyed.
+    // Returns false if the logger is asynchronous already.
+    bool setAsync(size_t queueSize = DEFAULT_LOG_QUEUE_SIZE,
+                  LogOverflow overflow = LogOverflow::BLOCK);
+    inline bool isAsync() { return queue.load(std::memory_order_acquire); }
+    // Waits until the records logged so far (by any thread) are written, and flushes the sinks.
+    void flush();
+    // Records dropped as per LogOverflow::DROP_AND_COUNT.
+    inline size_t getDroppedCount() { return dropped.load(std::memory_order_relaxed); }
+
+    // Makes the logger write the records made through the LOG_* macros to file in binary instead
+    // of to its sinks: each record is just the ID of its call site, its time and the raw bytes of
+    // its arguments, copied to a buffer of the logging thread. Formatting is left to
+    // decodeBinaryLog() (or the LogDecoder tool), which uses the site definitions saved in the
+    // file. Can only be done once. Returns false if the file cannot be opened, or the logger is
+    // binary already.
+    bool setBinary(const Path &file);
+    inline bool isBinary() { return binary.load(std::memory_order_relaxed); }
+
+    // Used by the LOG_* macros, which check the level beforehand.
+    template<typename... Args> void logAt(LogSite &site, Args &&...args)
+    {
+        if(!binary.load(std::memory_order_relaxed)) {
+            logText(site.lvl, std::forward<Args>(args)...);
+            return;
+        }
+        logBinary<false>(site, args...);
+        if(site.lvl == LogLevels::FATAL) flush();
+    }
+    // Used by the LOGF_* macros. The record is formatted into a buffer of the calling thread, so
+    // once that (and the async queue) have grown large enough, logging doesn't allocate.
+    template<typename... Args>
+    void logFormat(LogSite &site, utils::FormatString<std::type_identity_t<Args>...> fmt,
+                   const Args &...args)
+    {
+        if(binary.load(std::memory_order_relaxed)) {
+            logBinary<true>(site, args...);
+            if(site.lvl == LogLevels::FATAL) flush();
+            return;
+        }
+        String &buf = logFormatBuffer();
+        buf.clear();
+        utils::formatTo(buf, fmt, args...);
+        logInternal(site.lvl, buf);
+    }
+
     template<typename... Args> void fatal(Args &&...args)
     {
         log(LogLevels::FATAL, std::forward<Args>(args)...);
@@ -82,38 +468,114 @@ public:
         log(LogLevels::TRACE, std::forward<Args>(args)...);
     }
 
-    inline void setLevel(LogLevels::LogLevels lvl) { level = lvl; }
-    inline LogLevels::LogLevels getLevel() { return level; }
-    inline bool isLevelLoggable(LogLevels::LogLevels lvl) { return level >= lvl; }
+    // The level can be changed at any time, by any thread. Updates the sites bound to the logger.
+    void setLevel(LogLevels::LogLevels lvl);
+    inline LogLevels::LogLevels getLevel() { return level.load(std::memory_order_relaxed); }
+    inline bool isLevelLoggable(LogLevels::LogLevels lvl) { return getLevel() >= lvl; }
+    inline Atomic<LogLevels::LogLevels> &getLevelVar() { return level; }
 };
 
 extern DLL_EXPORT Logger logger;
 
-#define LOG_OBJ_FATAL(loggerObj, ...)                                                     \
-    do {                                                                                  \
-        if(loggerObj.isLevelLoggable(LogLevels::FATAL)) { loggerObj.fatal(__VA_ARGS__); } \
-    } while(false)
-#define LOG_OBJ_WARN(loggerObj, ...)                                                    \
-    do {                                                                                \
-        if(loggerObj.isLevelLoggable(LogLevels::WARN)) { loggerObj.warn(__VA_ARGS__); } \
-    } while(false)
-#define LOG_OBJ_INFO(loggerObj, ...)                                                    \
-    do {                                                                                \
-        if(loggerObj.isLevelLoggable(LogLevels::INFO)) { loggerObj.info(__VA_ARGS__); } \
-    } while(false)
-#define LOG_OBJ_DEBUG(loggerObj, ...)                                                     \
-    do {                                                                                  \
-        if(loggerObj.isLevelLoggable(LogLevels::DEBUG)) { loggerObj.debug(__VA_ARGS__); } \
+// Named log level for a module, so that (for example) TRACE can be enabled for one subsystem at
+// runtime without enabling it everywhere. The records of the LOG_CAT_* macros go to the logger of
+// the category, and are only subject to the level of the category.
+// Categories are registered by name for setLogCategoryLevel(), and must outlive their uses.
+class LogCategory
+{
+    const char *name;
+    Logger &log;
+    Atomic<LogLevels::LogLevels> level;
+
+public:
+    LogCategory(const char *name, LogLevels::LogLevels lvl = LogLevels::WARN,
+                Logger &log = logger);
+    ~LogCategory();
+
+    LogCategory(const LogCategory &other)            = delete;
+    LogCategory &operator=(const LogCategory &other) = delete;
+
+    inline const char *getName() { return name; }
+    inline Logger &getLogger() { return log; }
+    // Updates the sites bound to the category.
+    void setLevel(LogLevels::LogLevels lvl);
+    inline LogLevels::LogLevels getLevel() { return level.load(std::memory_order_relaxed); }
+    inline bool isLevelLoggable(LogLevels::LogLevels lvl) { return getLevel() >= lvl; }
+    inline Atomic<LogLevels::LogLevels> &getLevelVar() { return level; }
+};
+
+// Sets the level of every category with the given name. Returns false if there is none.
+bool setLogCategoryLevel(StringRef name, LogLevels::LogLevels lvl);
+// Names of the categories which currently exist.
+Vector<String> getLogCategories();
+
+// levelObj (a Logger or LogCategory) decides whether the statement is logged, unless the mode of
+// the site says otherwise (see setLogSiteMode()).
+// The site is constant initialized, so it costs nothing but the check of its state.
+#define LOG_SITE_INIT(lvl, fmt) {__FILE__, __func__, __LINE__, lvl, {}, {0}, {0}, {}, fmt}
+#define LOG_AT_IMPL(levelObj, loggerObj, lvl, ...)                                         \
+    do {                                                                                   \
+        if constexpr(::core::isLogLevelCompiled(lvl)) {                                    \
+            static ::core::LogSite _logSite LOG_SITE_INIT(lvl, nullptr);                   \
+            if(::core::isLogSiteEnabled(_logSite, levelObj)) {                             \
+                loggerObj.logAt(_logSite, __VA_ARGS__);                                    \
+            }                                                                              \
+        }                                                                                  \
     } while(false)
-#define LOG_OBJ_TRACE(loggerObj, ...)                                                     \
-    do {                                                                                  \
-        if(loggerObj.isLevelLoggable(LogLevels::TRACE)) { loggerObj.trace(__VA_ARGS__); } \
+#define LOGF_AT_IMPL(levelObj, loggerObj, lvl, fmt, ...)                                   \
+    do {                                                                                   \
+        if constexpr(::core::isLogLevelCompiled(lvl)) {                                    \
+            static ::core::LogSite _logSite LOG_SITE_INIT(lvl, fmt);                       \
+            if(::core::isLogSiteEnabled(_logSite, levelObj)) {                             \
+                loggerObj.logFormat(_logSite, fmt __VA_OPT__(, ) __VA_ARGS__);             \
+            }                                                                              \
+        }                                                                                  \
     } while(false)
 
+#define LOG_OBJ_AT(loggerObj, lvl, ...) LOG_AT_IMPL(loggerObj, loggerObj, lvl, __VA_ARGS__)
+
+#define LOG_OBJ_FATAL(loggerObj, ...) LOG_OBJ_AT(loggerObj, ::core::LogLevels::FATAL, __VA_ARGS__)
+#define LOG_OBJ_WARN(loggerObj, ...) LOG_OBJ_AT(loggerObj, ::core::LogLevels::WARN, __VA_ARGS__)
+#define LOG_OBJ_INFO(loggerObj, ...) LOG_OBJ_AT(loggerObj, ::core::LogLevels::INFO, __VA_ARGS__)
+#define LOG_OBJ_DEBUG(loggerObj, ...) LOG_OBJ_AT(loggerObj, ::core::LogLevels::DEBUG, __VA_ARGS__)
+#define LOG_OBJ_TRACE(loggerObj, ...) LOG_OBJ_AT(loggerObj, ::core::LogLevels::TRACE, __VA_ARGS__)
+
+// Same as above, but the record is formatted from fmt (a string literal) with "{}" placeholders -
+// see utils::formatTo(). The placeholder count is checked at compile time.
+#define LOGF_OBJ_AT(loggerObj, lvl, ...) LOGF_AT_IMPL(loggerObj, loggerObj, lvl, __VA_ARGS__)
+
+#define LOGF_OBJ_FATAL(loggerObj, ...) LOGF_OBJ_AT(loggerObj, ::core::LogLevels::FATAL, __VA_ARGS__)
+#define LOGF_OBJ_WARN(loggerObj, ...) LOGF_OBJ_AT(loggerObj, ::core::LogLevels::WARN, __VA_ARGS__)
+#define LOGF_OBJ_INFO(loggerObj, ...) LOGF_OBJ_AT(loggerObj, ::core::LogLevels::INFO, __VA_ARGS__)
+#define LOGF_OBJ_DEBUG(loggerObj, ...) LOGF_OBJ_AT(loggerObj, ::core::LogLevels::DEBUG, __VA_ARGS__)
+#define LOGF_OBJ_TRACE(loggerObj, ...) LOGF_OBJ_AT(loggerObj, ::core::LogLevels::TRACE, __VA_ARGS__)
+
+// Statements of a LogCategory.
+#define LOG_CAT_AT(cat, lvl, ...) LOG_AT_IMPL(cat, (cat).getLogger(), lvl, __VA_ARGS__)
+#define LOGF_CAT_AT(cat, lvl, ...) LOGF_AT_IMPL(cat, (cat).getLogger(), lvl, __VA_ARGS__)
+
+#define LOG_CAT_FATAL(cat, ...) LOG_CAT_AT(cat, ::core::LogLevels::FATAL, __VA_ARGS__)
+#define LOG_CAT_WARN(cat, ...) LOG_CAT_AT(cat, ::core::LogLevels::WARN, __VA_ARGS__)
+#define LOG_CAT_INFO(cat, ...) LOG_CAT_AT(cat, ::core::LogLevels::INFO, __VA_ARGS__)
+#define LOG_CAT_DEBUG(cat, ...) LOG_CAT_AT(cat, ::core::LogLevels::DEBUG, __VA_ARGS__)
+#define LOG_CAT_TRACE(cat, ...) LOG_CAT_AT(cat, ::core::LogLevels::TRACE, __VA_ARGS__)
+
+#define LOGF_CAT_FATAL(cat, ...) LOGF_CAT_AT(cat, ::core::LogLevels::FATAL, __VA_ARGS__)
+#define LOGF_CAT_WARN(cat, ...) LOGF_CAT_AT(cat, ::core::LogLevels::WARN, __VA_ARGS__)
+#define LOGF_CAT_INFO(cat, ...) LOGF_CAT_AT(cat, ::core::LogLevels::INFO, __VA_ARGS__)
+#define LOGF_CAT_DEBUG(cat, ...) LOGF_CAT_AT(cat, ::core::LogLevels::DEBUG, __VA_ARGS__)
+#define LOGF_CAT_TRACE(cat, ...) LOGF_CAT_AT(cat, ::core::LogLevels::TRACE, __VA_ARGS__)
+
 #define LOG_FATAL(...) LOG_OBJ_FATAL(::core::logger, __VA_ARGS__)
 #define LOG_WARN(...) LOG_OBJ_WARN(::core::logger, __VA_ARGS__)
 #define LOG_INFO(...) LOG_OBJ_INFO(::core::logger, __VA_ARGS__)
 #define LOG_DEBUG(...) LOG_OBJ_DEBUG(::core::logger, __VA_ARGS__)
 #define LOG_TRACE(...) LOG_OBJ_TRACE(::core::logger, __VA_ARGS__)
 
+#define LOGF_FATAL(...) LOGF_OBJ_FATAL(::core::logger, __VA_ARGS__)
+#define LOGF_WARN(...) LOGF_OBJ_WARN(::core::logger, __VA_ARGS__)
+#define LOGF_INFO(...) LOGF_OBJ_INFO(::core::logger, __VA_ARGS__)
+#define LOGF_DEBUG(...) LOGF_OBJ_DEBUG(::core::logger, __VA_ARGS__)
+#define LOGF_TRACE(...) LOGF_OBJ_TRACE(::core::logger, __VA_ARGS__)
+
 } // namespace core
\ No newline at end of file
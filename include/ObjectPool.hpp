@@ -0,0 +1,183 @@
+#pragma once
+
+#include "Allocator.hpp"
+
+namespace core
+{
+
+// Stores objects of type T densely in blocks of BlockSlots slots (taken from a MemoryManager),
+// without any per object header. Used slots are tracked by a bitmap in each block, which also
+// makes iterating over the live objects (in memory order) cheap.
+// Not thread safe.
+template<typename T, size_t BlockSlots = 256> class ObjectPool
+{
+    static_assert(BlockSlots > 0 && BlockSlots % 64 == 0, "BlockSlots must be a multiple of 64");
+    static constexpr size_t BITMAP_WORDS = BlockSlots / 64;
+
+    struct Block
+    {
+        // Set bits are the used slots.
+        Array<uint64_t, BITMAP_WORDS> used;
+        size_t live;
+        // Blocks with free slots, linked through this.
+        Block *nextFree;
+        bool listed;
+
+        inline T *slots() { return (T *)((char *)this + SLOTS_OFFSET); }
+    };
+    static constexpr size_t SLOTS_OFFSET = (sizeof(Block) + alignof(T) - 1) & ~(alignof(T) - 1);
+    static constexpr size_t BLOCK_BYTES  = SLOTS_OFFSET + BlockSlots * sizeof(T);
+
+    MemoryManager &mem;
+    // Sorted by address, so that the block of an object can be found by a binary search, and
+    // iterating over the blocks goes in memory order.
+    Vector<Block *> blocks;
+    Block *freeBlocks;
+    size_t count;
+
+    // Returns nullptr if the MemoryManager is out of memory.
+    Block *newBlock()
+    {
+        size_t align    = std::max(alignof(T), alignof(Block));
+        Block *block    = (Block *)mem.allocRaw(BLOCK_BYTES, align);
+        if(!block) return nullptr;
+        block->used     = {};
+        block->live     = 0;
+        block->nextFree = nullptr;
+        block->listed   = false;
+        blocks.insert(std::upper_bound(blocks.begin(), blocks.end(), block), block);
+        return block;
+    }
+    Block *blockOf(T *obj)
+    {
+        auto it = std::upper_bound(blocks.begin(), blocks.end(), (Block *)obj);
+        assert(it != blocks.begin() && "object does not belong to the pool");
+        return *(it - 1);
+    }
+
+public:
+    // Iterates over the live objects in memory order.
+    class Iterator
+    {
+        const Vector<Block *> *blocks;
+        size_t blockIdx;
+        size_t word;
+        // Bits of the current bitmap word which haven't been visited yet.
+        uint64_t bits;
+        T *obj;
+
+        void next()
+        {
+            while(blockIdx < blocks->size()) {
+                Block *block = (*blocks)[blockIdx];
+                while(true) {
+                    if(bits != 0) {
+                        size_t slot = word * 64 + std::countr_zero(bits);
+                        bits &= bits - 1;
+                        obj = block->slots() + slot;
+                        return;
+                    }
+                    if(++word >= BITMAP_WORDS) break;
+                    bits = block->used[word];
+                }
+                if(++blockIdx < blocks->size()) {
+                    word = 0;
+                    bits = (*blocks)[blockIdx]->used[0];
+                }
+            }
+            obj = nullptr;
+        }
+
+    public:
+        Iterator(const Vector<Block *> *blocks, size_t blockIdx)
+            : blocks(blocks), blockIdx(blockIdx), word(0), bits(0), obj(nullptr)
+        {
+            if(blockIdx >= blocks->size()) return;
+            bits = (*blocks)[blockIdx]->used[0];
+            next();
+        }
+
+        inline T &operator*() const { return *obj; }
+        inline T *operator->() const { return obj; }
+        inline Iterator &operator++()
+        {
+            next();
+            return *this;
+        }
+        inline bool operator==(const Iterator &other) const { return obj == other.obj; }
+    };
+
+    ObjectPool(MemoryManager &mem) : mem(mem), freeBlocks(nullptr), count(0) {}
+    ~ObjectPool()
+    {
+        clear();
+        for(auto &block : blocks) mem.freeRaw(block);
+    }
+
+    ObjectPool(const ObjectPool &other)            = delete;
+    ObjectPool &operator=(const ObjectPool &other) = delete;
+
+    // Returns nullptr if no block can be allocated for the object.
+    template<typename... Args> T *alloc(Args &&...args)
+    {
+        Block *block = freeBlocks;
+        if(!block) {
+            if(!(block = newBlock())) return nullptr;
+            block->listed = true;
+            freeBlocks    = block;
+        }
+        size_t word = 0;
+        while(~block->used[word] == 0) ++word;
+        size_t slot = word * 64 + std::countr_zero(~block->used[word]);
+        T *obj      = new(block->slots() + slot) T(std::forward<Args>(args)...);
+        block->used[word] |= uint64_t(1) << (slot % 64);
+        ++count;
+        // Full blocks are taken out of the list, and put back when an object is freed.
+        if(++block->live == BlockSlots) {
+            freeBlocks    = block->nextFree;
+            block->listed = false;
+        }
+        return obj;
+    }
+    void free(T *obj)
+    {
+        if(!obj) return;
+        Block *block = blockOf(obj);
+        size_t slot  = obj - block->slots();
+        assert(block->used[slot / 64] & (uint64_t(1) << (slot % 64)) && "object already freed");
+        obj->~T();
+        block->used[slot / 64] &= ~(uint64_t(1) << (slot % 64));
+        --block->live;
+        --count;
+        if(!block->listed) {
+            block->nextFree = freeBlocks;
+            block->listed   = true;
+            freeBlocks      = block;
+        }
+    }
+    // Destroys all the objects. The blocks are kept for reuse.
+    void clear()
+    {
+        if constexpr(!std::is_trivially_destructible_v<T>) {
+            for(auto &obj : *this) obj.~T();
+        }
+        freeBlocks = nullptr;
+        for(auto &block : blocks) {
+            block->used     = {};
+            block->live     = 0;
+            block->nextFree = freeBlocks;
+            block->listed   = true;
+            freeBlocks      = block;
+        }
+        count = 0;
+    }
+
+    inline Iterator begin() const { return Iterator(&blocks, 0); }
+    inline Iterator end() const { return Iterator(&blocks, blocks.size()); }
+
+    inline size_t size() const { return count; }
+    inline size_t capacity() const { return blocks.size() * BlockSlots; }
+    inline bool empty() const { return count == 0; }
+};
+
+} // namespace core
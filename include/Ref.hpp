@@ -0,0 +1,171 @@
+#pragma once
+
+#include "Allocator.hpp"
+
+namespace core
+{
+
+template<typename T> class Ref;
+
+// Base class for IAllocated objects shared through Ref<T>. The reference count is kept in the
+// object itself, so sharing one needs no allocation besides the object's own (unlike
+// std::shared_ptr and its control block). Objects must be made by makeRef(), which records the
+// MemoryManager that the object goes back to once the last Ref to it is gone.
+class IRefCounted : public IAllocated
+{
+    Atomic<size_t> refs;
+    MemoryManager *mem;
+
+    template<typename T> friend class Ref;
+    template<typename T, typename... Args> friend Ref<T> makeRef(MemoryManager &, Args &&...);
+
+    inline void retain() { refs.fetch_add(1, std::memory_order_relaxed); }
+    inline void release()
+    {
+        // The last owner must see all the writes made through the other references.
+        if(refs.fetch_sub(1, std::memory_order_acq_rel) == 1) mem->freeDeinit(this);
+    }
+
+public:
+    IRefCounted() : refs(0), mem(nullptr) {}
+    // A copy is a different object, with its own references.
+    IRefCounted(const IRefCounted &) : IAllocated(), refs(0), mem(nullptr) {}
+    IRefCounted &operator=(const IRefCounted &) { return *this; }
+
+    inline size_t getRefCount() const { return refs.load(std::memory_order_relaxed); }
+};
+
+template<typename T> concept RefCountedDerived = std::is_base_of_v<IRefCounted, T>;
+
+// Shared handle to an object made by makeRef(). Copying one updates the reference count
+// atomically, so they can be shared across threads, while moving one doesn't touch the count.
+template<typename T> class Ref
+{
+    T *obj;
+
+    template<typename U> friend class Ref;
+
+public:
+    Ref() : obj(nullptr) {}
+    Ref(Nullptr) : obj(nullptr) {}
+    // Takes another reference to an object made by makeRef() - like from within the object, given
+    // its this pointer.
+    explicit Ref(T *obj) : obj(obj)
+    {
+        if(!obj) return;
+        assert(obj->mem && "object must be made by makeRef()");
+        obj->retain();
+    }
+    Ref(const Ref &other) : obj(other.obj)
+    {
+        if(obj) obj->retain();
+    }
+    Ref(Ref &&other) noexcept : obj(other.obj) { other.obj = nullptr; }
+    template<typename U>
+        requires std::is_convertible_v<U *, T *>
+    Ref(const Ref<U> &other) : obj(other.obj)
+    {
+        if(obj) obj->retain();
+    }
+    template<typename U>
+        requires std::is_convertible_v<U *, T *>
+    Ref(Ref<U> &&other) noexcept : obj(other.obj)
+    {
+        other.obj = nullptr;
+    }
+    ~Ref()
+    {
+        if(obj) obj->release();
+    }
+
+    Ref &operator=(Ref other) noexcept
+    {
+        std::swap(obj, other.obj);
+        return *this;
+    }
+
+    inline void reset() { Ref().swap(*this); }
+    inline void swap(Ref &other) noexcept { std::swap(obj, other.obj); }
+
+    inline T *get() const { return obj; }
+    inline T *operator->() const { return obj; }
+    inline T &operator*() const { return *obj; }
+    inline explicit operator bool() const { return obj; }
+    inline size_t getRefCount() const { return obj ? obj->getRefCount() : 0; }
+
+    template<typename U> inline bool operator==(const Ref<U> &other) const
+    {
+        return obj == other.obj;
+    }
+    inline bool operator==(Nullptr) const { return obj == nullptr; }
+};
+
+template<typename T, typename... Args> Ref<T> makeRef(MemoryManager &mem, Args &&...args)
+{
+    static_assert(RefCountedDerived<T>, "Ref<T> requires T to be derived from IRefCounted");
+    T *obj   = mem.allocInit<T>(std::forward<Args>(args)...);
+    obj->mem = &mem;
+    return Ref<T>(obj);
+}
+
+// Sole owner of an IAllocated object, which is given back to its MemoryManager (via
+// MemoryManager::freeDeinit()) when the handle is destroyed.
+template<typename T> class Unique
+{
+    T *obj;
+    MemoryManager *mem;
+
+    template<typename U> friend class Unique;
+
+public:
+    Unique() : obj(nullptr), mem(nullptr) {}
+    Unique(Nullptr) : obj(nullptr), mem(nullptr) {}
+    // Takes over an object allocated from mem.
+    Unique(T *obj, MemoryManager &mem) : obj(obj), mem(&mem) {}
+    Unique(Unique &&other) noexcept : obj(other.obj), mem(other.mem) { other.obj = nullptr; }
+    template<typename U>
+        requires std::is_convertible_v<U *, T *>
+    Unique(Unique<U> &&other) noexcept : obj(other.obj), mem(other.mem)
+    {
+        other.obj = nullptr;
+    }
+    ~Unique() { reset(); }
+
+    Unique(const Unique &other)            = delete;
+    Unique &operator=(const Unique &other) = delete;
+
+    Unique &operator=(Unique &&other) noexcept
+    {
+        Unique tmp(std::move(other));
+        std::swap(obj, tmp.obj);
+        std::swap(mem, tmp.mem);
+        return *this;
+    }
+
+    inline void reset()
+    {
+        if(obj) mem->freeDeinit(obj);
+        obj = nullptr;
+    }
+    // Gives up the object without freeing it.
+    inline T *release()
+    {
+        T *res = obj;
+        obj    = nullptr;
+        return res;
+    }
+
+    inline T *get() const { return obj; }
+    inline T *operator->() const { return obj; }
+    inline T &operator*() const { return *obj; }
+    inline explicit operator bool() const { return obj; }
+    inline MemoryManager *getMemoryManager() const { return mem; }
+};
+
+template<IAllocatedDerived T, typename... Args>
+Unique<T> makeUnique(MemoryManager &mem, Args &&...args)
+{
+    return Unique<T>(mem.allocInit<T>(std::forward<Args>(args)...), mem);
+}
+
+} // namespace core
@@ -18,6 +18,16 @@ public:
         utils::appendToString(msg, std::forward<Args>(msgArgs)...);
     }
 
+    // Same, but the message is built from a compile-time checked format string (utils::format).
+    template<typename... Args>
+    static Status fmt(T &&ret, utils::FormatString<std::type_identity_t<Args>...> fmtStr,
+                      const Args &...args)
+    {
+        Status res(std::move(ret));
+        utils::formatTo(res.msg, fmtStr, args...);
+        return res;
+    }
+
     inline const T &getCode() { return ret; }
     inline StringRef getMsg() { return msg; }
 };
@@ -84,6 +84,83 @@ template<typename... Args> String toString(Args... args)
     return dest;
 }
 
+// Formatting with "{}" placeholders (use "{{" and "}}" for literal braces).
+// Unlike appendToString(), the format string is checked against the argument count at compile
+// time, and numbers are written with std::to_chars (bool as true/false, floats in shortest form).
+
+inline void formatValue(String &dest, bool data) { dest += data ? "true" : "false"; }
+inline void formatValue(String &dest, char data) { dest += data; }
+inline void formatValue(String &dest, const char *data) { dest += data; }
+inline void formatValue(String &dest, StringRef data) { dest += data; }
+template<typename T>
+requires(std::is_arithmetic_v<T>)
+void formatValue(String &dest, T data)
+{
+    char buf[64];
+    auto res = std::to_chars(buf, buf + sizeof(buf), data);
+    dest.append(buf, res.ptr);
+}
+// Everything else (like Path) goes through appendToString().
+template<typename T>
+requires(!std::is_arithmetic_v<T> && !std::is_convertible_v<const T &, StringRef>)
+void formatValue(String &dest, const T &data)
+{
+    appendToString(dest, data);
+}
+
+// Not constexpr, so calling it from FormatString's constructor fails the compilation.
+void invalidFormatString(const char *reason);
+
+// Returns the number of placeholders in fmt, or -1 if it has a stray brace.
+consteval int countFormatPlaceholders(StringRef fmt)
+{
+    int count = 0;
+    for(size_t i = 0; i < fmt.size(); ++i) {
+        if(fmt[i] != '{' && fmt[i] != '}') continue;
+        if(i + 1 >= fmt.size()) return -1;
+        if(fmt[i] == '{' && fmt[i + 1] == '}') ++count;
+        else if(fmt[i] != fmt[i + 1]) return -1;
+        ++i;
+    }
+    return count;
+}
+
+template<typename... Args> class FormatString
+{
+    StringRef str;
+
+public:
+    template<typename S>
+    requires(std::is_convertible_v<const S &, StringRef>)
+    consteval FormatString(const S &fmt) : str(fmt)
+    {
+        int count = countFormatPlaceholders(str);
+        if(count < 0) invalidFormatString("unmatched brace in format string");
+        if(count != sizeof...(Args)) invalidFormatString("placeholder/argument count mismatch");
+    }
+
+    constexpr StringRef get() const { return str; }
+};
+
+// Appends the literal part of fmt (with escapes resolved) up to the first placeholder, and returns
+// the rest of fmt after that placeholder.
+StringRef appendFormatLiteral(String &dest, StringRef fmt);
+
+template<typename... Args>
+void formatTo(String &dest, FormatString<std::type_identity_t<Args>...> fmt, const Args &...args)
+{
+    StringRef rest = fmt.get();
+    ((rest = appendFormatLiteral(dest, rest), formatValue(dest, args)), ...);
+    appendFormatLiteral(dest, rest);
+}
+template<typename... Args>
+String format(FormatString<std::type_identity_t<Args>...> fmt, const Args &...args)
+{
+    String dest;
+    formatTo(dest, fmt, args...);
+    return dest;
+}
+
 void output(OStream &os, File *src, size_t locStart, size_t locEnd, StringRef data);
 
 } // namespace core::utils
\ No newline at end of file
@@ -0,0 +1,42 @@
+#pragma once
+
+#include "Core.hpp"
+
+// Thin wrappers over the OS virtual memory APIs (mmap / VirtualAlloc).
+namespace core::vm
+{
+
+size_t pageSize();
+
+// Reserves `size` bytes of address space (aligned to at least the page size).
+// The memory must be committed before it is used. Returns nullptr on failure.
+void *reserve(size_t size);
+// Same as reserve(), but the memory is aligned to align (a power of two).
+void *reserveAligned(size_t size, size_t align);
+// Makes the reserved memory usable. On POSIX systems, reserved memory is always usable (physical
+// pages are only used once touched), so this doesn't do anything there.
+bool commit(void *addr, size_t size);
+// Gives the physical memory backing the range back to the OS. The range stays usable, but its
+// contents are undefined afterwards.
+bool purge(void *addr, size_t size);
+// Asks the OS to back the range with huge pages (transparent huge pages on Linux).
+// Returns false if that isn't supported.
+bool adviseHugePages(void *addr, size_t size);
+// Resizes a range obtained via reserve() (committed, if required), moving it if it cannot be
+// resized in place. Contents are kept, and the range is only aligned to the page size if moved.
+// Returns nullptr (keeping the old range) on failure, or if the OS doesn't support it (only Linux
+// does).
+void *remap(void *addr, size_t oldSize, size_t newSize);
+// Releases the address space obtained via reserve() or reserveAligned().
+void release(void *addr, size_t size);
+
+// Maps size bytes of the file (created, or extended to size, if required) at exactly base,
+// shared - so changes to the memory go to the file. Returns nullptr on failure, including when
+// the range at base isn't free.
+void *mapFile(const Path &path, size_t size, void *base);
+// Writes the changes to the mapped range back to its file.
+bool syncFile(void *addr, size_t size);
+// Unmaps the range obtained via mapFile().
+void unmapFile(void *addr, size_t size);
+
+} // namespace core::vm
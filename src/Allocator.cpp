@@ -1,6 +1,7 @@
 #include "Allocator.hpp"
 
 #include "Logger.hpp"
+#include "VirtualMem.hpp"
 
 // aligned_alloc doesn't exist on Windows, so we use _aligned_malloc and _aligned_free instead.
 #if defined(CORE_OS_WINDOWS)
@@ -15,164 +16,1658 @@
 namespace core
 {
 
-static Atomic<size_t> totalAllocRequests = 0, totalAllocBytes = 0, totalPoolAlloc = 0,
-                      chunkReuseCount = 0;
+static Atomic<size_t> nextManagerId = 1;
 
-MemoryManager::MemoryManager(StringRef name, size_t poolSize)
-    : freechunks({}), name(name), poolSize(poolSize)
+// IDs of the managers which are alive. Used by exiting threads to find out which of their arenas
+// still exist. Intentionally leaked so that they outlive all static and thread_local destructors.
+static Mutex &liveManagersMtx()
 {
-    allocPool();
+    static Mutex *mtx = new Mutex;
+    return *mtx;
 }
-MemoryManager::~MemoryManager()
+static Set<size_t> &liveManagers()
+{
+    static Set<size_t> *ids = new Set<size_t>;
+    return *ids;
+}
+
+struct ThreadArena
+{
+    size_t managerId;
+    MemArena *arena;
+};
+
+// Arenas owned by the thread. Gives them up when the thread exits.
+struct ThreadArenaList
+{
+    Vector<ThreadArena> arenas;
+
+    ~ThreadArenaList();
+};
+
+// Most recently used arena of the thread - avoids going through the list for the common case of a
+// single manager being used.
+static thread_local ThreadArena lastArena = {0, nullptr};
+static thread_local ThreadArenaList threadArenaList;
+// threadArenaList must not be used once it has been destroyed (by the exiting thread).
+static thread_local bool threadArenaListDestroyed = false;
+
+ThreadArenaList::~ThreadArenaList()
+{
+    LockGuard<Mutex> lock(liveManagersMtx());
+    for(auto &ta : arenas) {
+        if(!liveManagers().contains(ta.managerId)) continue;
+        ta.arena->owned.store(false, std::memory_order_release);
+    }
+    lastArena                = {0, nullptr};
+    threadArenaListDestroyed = true;
+}
+
+// Tagged pointers for the lock-free free chunk lists.
+// The upper bits hold a counter which is incremented on every push and pop, so that a list head
+// which has been popped and pushed back by another thread in the meantime never compares equal
+// (ABA problem). User space addresses fit in the lower 48 bits on 64-bit platforms.
+static constexpr size_t TAG_SHIFT     = sizeof(void *) == 8 ? 48 : 32;
+static constexpr uint64_t TAG_ONE     = uint64_t(1) << TAG_SHIFT;
+static constexpr uint64_t TAG_ADDRESS = TAG_ONE - 1;
+
+// AllocDetails::NEXT of a chunk in a lock-free free chunk list. Accessed atomically as it can be
+// read by a thread which lost the race to pop the chunk.
+static inline std::atomic_ref<size_t> chunkNext(size_t chunk)
+{
+    return std::atomic_ref<size_t>(
+        (*(AllocDetail *)((char *)chunk - ALLOC_DETAIL_BYTES))[(uint32_t)AllocDetails::NEXT]);
+}
+
+// AllocDetails::DATA of pooled allocations holds the address of their pool along with their
+// alignment class in the lower bits (pools are aligned well beyond that). For other allocations,
+// it holds the start of their memory tagged with LARGE_ALLOC.
+static constexpr size_t DATA_TAG_MASK = 7;
+static constexpr size_t LARGE_ALLOC   = DATA_TAG_MASK;
+static_assert(ALIGN_CLASS_COUNT <= LARGE_ALLOC, "alignment classes must fit in the DATA tag");
+static_assert(alignof(MemPool) > DATA_TAG_MASK && MAX_ALIGNMENT > DATA_TAG_MASK);
+
+static inline MemPool *poolOf(size_t detail) { return (MemPool *)(detail & ~DATA_TAG_MASK); }
+
+// Smallest chunk which can be made out of the padding of an aligned allocation.
+static constexpr size_t MIN_CHUNK = SIZE_CLASSES[calcSizeClass(ALLOC_DETAIL_BYTES + 1)];
+
+// Bytes needed after p so that p + ALLOC_DETAIL_BYTES is aligned to align.
+static inline size_t alignPadding(char *p, size_t align)
+{
+    return (0 - (size_t)(p + ALLOC_DETAIL_BYTES)) & (align - 1);
+}
+
+// Counters are only modified by the owner of their arena, see MemCounters.
+static inline void addTo(Atomic<size_t> &counter, size_t n)
+{
+    counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+static inline void subFrom(Atomic<size_t> &counter, size_t n)
+{
+    counter.store(counter.load(std::memory_order_relaxed) - n, std::memory_order_relaxed);
+}
+
+// "COREHEAP"
+static constexpr uint64_t PERSISTENT_MAGIC   = 0x504145484552'4f43;
+static constexpr uint32_t PERSISTENT_VERSION = 1;
+// Files are mapped (and carved after the header) in multiples of this, which covers the page size
+// (and the allocation granularity on Windows).
+static constexpr size_t PERSISTENT_GRANULE = 64 * 1024;
+
+// Pools of persistent managers are carved from their file, right before their memory.
+struct PersistentPool
+{
+    PersistentPool *next;
+    MemPool pool;
+
+    PersistentPool(char *mem, size_t size, MemArena *arena)
+        : next(nullptr), pool(mem, size, arena)
+    {}
+};
+
+static constexpr size_t PERSISTENT_POOL_BYTES =
+    (sizeof(PersistentPool) + MAX_ALIGNMENT - 1) & ~(MAX_ALIGNMENT - 1);
+
+struct PersistentRoot
+{
+    char name[MAX_ROOT_NAME_CHARS + 1];
+    size_t alloc;
+};
+
+// Stored at the start of the file of a persistent manager, followed by everything carved from it.
+struct PersistentHeader
+{
+    uint64_t magic;
+    uint32_t version;
+    // sizeof(PersistentHeader), which changes along with the number of size classes.
+    uint32_t headerBytes;
+    size_t base;
+    size_t capacity;
+    // Bytes of the file carved so far.
+    size_t used;
+    // Set while a manager has the file open. A file which is still dirty when it is reopened
+    // wasn't saved by its last manager.
+    uint32_t dirty;
+    PersistentPool *firstPool;
+    PersistentPool *lastPool;
+    // The state of the manager which isn't in the pools, saved by MemoryManager::closePersistent().
+    Array<Array<size_t, SIZE_CLASS_COUNT>, ALIGN_CLASS_COUNT> freechunks;
+    Array<char *, LARGE_CLASS_COUNT> largeCache;
+    size_t largeCacheBytes;
+    MemStats counters;
+    Array<PersistentRoot, MAX_PERSISTENT_ROOTS> roots;
+};
+
+static constexpr size_t PERSISTENT_HEADER_BYTES =
+    (sizeof(PersistentHeader) + PERSISTENT_GRANULE - 1) & ~(PERSISTENT_GRANULE - 1);
+
+MemCounters::MemCounters()
+    : allocCount(0), freeCount(0), reuseCount(0), requestedBytes(0), allocBytes(0), freedBytes(0),
+      classAllocs({}), classFrees({}), classFreeChunks({})
+{}
+
+MemPool::MemPool(char *mem, size_t size, MemArena *arena)
+    : head(mem), mem(mem), size(size), arena(arena), live(0)
+{}
+
+MemArena::MemArena()
+    : freechunks({}), sharedchunks({}), slabs({}), emptySlabs(nullptr), current(nullptr),
+      remoteFree(0), owned(false), trimRequested(false), sampleCountdown(0)
+{}
+
+MemResource::MemResource(MemoryManager &mem) : mem(mem) {}
+
+void *MemResource::do_allocate(size_t bytes, size_t align)
+{
+    // memory_resource must return a unique pointer even for zero bytes.
+    void *res = mem.allocRaw(std::max(bytes, size_t(1)), align);
+    if(!res) throw std::bad_alloc();
+    return res;
+}
+void MemResource::do_deallocate(void *p, size_t, size_t) { mem.freeRaw(p); }
+bool MemResource::do_is_equal(const std::pmr::memory_resource &other) const noexcept
+{
+    const MemResource *res = dynamic_cast<const MemResource *>(&other);
+    return res && &res->mem == &mem;
+}
+
+MemoryManager::MemoryManager(StringRef name, size_t poolSize, uint32_t flags)
+    : MemoryManager(name, poolSize, flags, nullptr, 0, 0)
+{}
+MemoryManager::MemoryManager(StringRef name, const Path &file, size_t capacity, size_t poolSize,
+                             size_t base)
+    : MemoryManager(name, poolSize, MemFlags::NONE, &file, capacity, base)
+{}
+MemoryManager::MemoryManager(StringRef name, size_t poolSize, uint32_t flags, const Path *file,
+                             size_t capacity, size_t base)
+    : name(name), poolSize(poolSize), id(nextManagerId++), flags(flags), sharedArena(nullptr),
+      slabBegin(nullptr), slabEnd(nullptr), slabsUsed(0), largeCache({}), largeCacheBytes(0),
+      largeCacheLimit(DEFAULT_LARGE_CACHE_LIMIT), purgedSlabCount(0), osBytes(0), peakOsBytes(0),
+      profiler(nullptr), persistent(nullptr), resource(*this)
 {
-    // clear out the allocations that are larger than MAX_ROUNDUP
-    for(auto &sz : freechunks) {
-        if(sz == 0) continue;
-        size_t allocAddr = sz;
-        while(allocAddr > 0) {
-            if(getAllocDetail(allocAddr, AllocDetails::SIZE) <= poolSize) break;
-            AlignedFree((char *)allocAddr - ALLOC_DETAIL_BYTES);
-            allocAddr = getAllocDetail(allocAddr, AllocDetails::NEXT);
+    {
+        LockGuard<Mutex> lock(liveManagersMtx());
+        liveManagers().insert(id);
+    }
+    bool reopened = file && openPersistent(*file, capacity, base);
+    if(flags & MemFlags::LOCK_FREE) this->flags &= ~MemFlags::SLABS;
+    if(this->flags & MemFlags::SLABS) {
+        slabBegin = (char *)vm::reserve(SLAB_RESERVE);
+        if(slabBegin) {
+            slabEnd = slabBegin + SLAB_RESERVE;
+            assert((size_t)slabBegin % SLAB_SIZE == 0 && "slabs must be aligned to SLAB_SIZE");
+        } else {
+            LOG_WARN("Failed to reserve memory for slabs, not using slabs for manager: ", name);
+            this->flags &= ~MemFlags::SLABS;
         }
-        sz = 0;
     }
-    for(auto &p : pools) AlignedFree(p.mem);
+    // The first arena is left unowned so that the first thread which uses the manager adopts it.
+    MemArena *arena = new MemArena();
+    arenas.push_back(arena);
+    if(flags & MemFlags::LOCK_FREE) sharedArena = arena;
+    // A reopened file has its pools already, and a new file gets its first pool once required.
+    if(reopened) adoptPersistent();
+    if(persistent) return;
+    LockGuard<Mutex> lock(arena->mtx);
+    allocPool(*arena);
+}
+MemoryManager::~MemoryManager()
+{
+    setTrimInterval(std::chrono::milliseconds(0));
+    {
+        LockGuard<Mutex> lock(liveManagersMtx());
+        liveManagers().erase(id);
+    }
+    MemStats s = stats();
     LOG_INFO("=============== ", name, " memory manager stats: ===============");
-    LOG_INFO("-- Total allocated bytes (pools + otherwise): ", totalAllocBytes.load());
-    LOG_INFO("--                Allocated bytes from pools: ", totalPoolAlloc.load());
-    LOG_INFO("--                             Request count: ", totalAllocRequests.load());
-    LOG_INFO("--                         Chunk Reuse count: ", chunkReuseCount.load());
+    LOG_INFO("-- Peak bytes from OS (pools + otherwise): ", s.peakOsBytes);
+    LOG_INFO("--                 Allocated bytes (live): ", s.allocBytes, " (", s.liveBytes, ")");
+    LOG_INFO("--                  Request (free) count: ", s.allocCount, " (", s.freeCount, ")");
+    LOG_INFO("--                      Chunk Reuse count: ", s.reuseCount);
+    LOG_INFO("--                        Requested bytes: ", s.requestedBytes);
+    // The pools of a persistent manager live in its file.
+    if(persistent) closePersistent();
+    for(auto &a : arenas) {
+        for(auto &p : a->pools) {
+            if(persistent) break;
+            AlignedFree(p->mem);
+            delete p;
+        }
+        delete a;
+    }
+    if(slabBegin) vm::release(slabBegin, SLAB_RESERVE);
+    releaseLargeCache(0);
+    delete profiler.load();
 }
 
-size_t MemoryManager::nextPow2(size_t sz)
+MemPool *MemoryManager::allocPool(MemArena &arena)
 {
-    if(sz > MAX_ROUNDUP) return sz;
-    --sz;
-    sz |= sz >> 1;
-    sz |= sz >> 2;
-    sz |= sz >> 4;
-    sz |= sz >> 8;
-    sz |= sz >> 16;
-    return ++sz;
+    // Growing the pools geometrically keeps their count logarithmic in the size of the heap.
+    size_t size = poolSize;
+    if(!arena.pools.empty()) {
+        size = std::max(std::min(arena.pools.back()->size * 2, MAX_POOL_SIZE), poolSize);
+    }
+    MemPool *pool = nullptr;
+    if(persistent) {
+        char *mem = carvePersistent(PERSISTENT_POOL_BYTES + size, MAX_ALIGNMENT);
+        if(!mem) return nullptr;
+        PersistentPool *p = new(mem) PersistentPool(mem + PERSISTENT_POOL_BYTES, size, &arena);
+        LockGuard<Mutex> lock(persistentMtx);
+        if(persistent->lastPool) persistent->lastPool->next = p;
+        else persistent->firstPool = p;
+        persistent->lastPool = p;
+        pool                 = &p->pool;
+    } else {
+        char *alloc = (char *)AlignedAlloc(MAX_ALIGNMENT, size);
+        addOsBytes(size);
+        pool = new MemPool(alloc, size, &arena);
+    }
+    arena.pools.push_back(pool);
+    arena.current.store(pool, std::memory_order_release);
+    return pool;
 }
 
-void MemoryManager::allocPool()
+MemArena *MemoryManager::getThreadArena()
 {
-    char *alloc = (char *)AlignedAlloc(MAX_ALIGNMENT, poolSize);
-    totalAllocBytes += poolSize;
-    pools.emplace_back(alloc, alloc);
+    if(lastArena.managerId == id) return lastArena.arena;
+    if(threadArenaListDestroyed) return nullptr;
+    for(auto &ta : threadArenaList.arenas) {
+        if(ta.managerId != id) continue;
+        lastArena = ta;
+        return ta.arena;
+    }
+    return nullptr;
+}
+
+MemArena *MemoryManager::acquireThreadArena(bool &borrowed)
+{
+    MemArena *arena = getThreadArena();
+    borrowed        = false;
+    if(arena) return arena;
+    {
+        LockGuard<Mutex> lock(arenasMtx);
+        for(auto &a : arenas) {
+            bool expected = false;
+            if(a->owned.compare_exchange_strong(expected, true, std::memory_order_acquire)) {
+                arena = a;
+                break;
+            }
+        }
+        if(!arena) {
+            arena = new MemArena();
+            arena->owned.store(true, std::memory_order_relaxed);
+            arenas.push_back(arena);
+        }
+    }
+    // An exiting thread cannot remember the arena, so the caller must give it up after use.
+    borrowed = threadArenaListDestroyed;
+    if(borrowed) return arena;
+    {
+        // Forget the arenas of managers which don't exist anymore.
+        LockGuard<Mutex> lock(liveManagersMtx());
+        std::erase_if(threadArenaList.arenas, [](const ThreadArena &ta) {
+            return !liveManagers().contains(ta.managerId);
+        });
+    }
+    threadArenaList.arenas.push_back({id, arena});
+    lastArena = {id, arena};
+    return arena;
+}
+
+void MemoryManager::addOsBytes(size_t bytes)
+{
+    size_t now  = osBytes.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+    size_t peak = peakOsBytes.load(std::memory_order_relaxed);
+    while(now > peak && !peakOsBytes.compare_exchange_weak(peak, now, std::memory_order_relaxed));
+}
+void MemoryManager::subOsBytes(size_t bytes)
+{
+    osBytes.fetch_sub(bytes, std::memory_order_relaxed);
+}
+
+bool MemoryManager::collectRemoteFree(MemArena &arena)
+{
+    // Avoids the read-modify-write when nothing has been freed remotely.
+    if(arena.remoteFree.load(std::memory_order_relaxed) == 0) return false;
+    // The whole list is taken at once, so there is no ABA problem despite the concurrent pushes.
+    size_t chunk = arena.remoteFree.exchange(0, std::memory_order_acquire);
+    while(chunk != 0) {
+        if(isSlabAlloc((char *)chunk)) {
+            size_t next = *(size_t *)chunk;
+            releaseSlabObject(arena, (char *)chunk);
+            chunk = next;
+            continue;
+        }
+        size_t next     = getAllocDetail(chunk, AllocDetails::NEXT);
+        size_t idx      = getSizeClass(getAllocDetail(chunk, AllocDetails::SIZE));
+        size_t detail   = getAllocDetail(chunk, AllocDetails::DATA);
+        size_t alignIdx = detail & DATA_TAG_MASK;
+        size_t &addrSz  = arena.freechunks[alignIdx][idx];
+        subFrom(poolOf(detail)->live, 1);
+        addTo(arena.counters.freeCount, 1);
+        addTo(arena.counters.freedBytes, SIZE_CLASSES[idx]);
+        addTo(arena.counters.classFrees[idx], 1);
+        addTo(arena.counters.classFreeChunks[idx], 1);
+        setAllocDetail(chunk, AllocDetails::NEXT, addrSz);
+        addrSz = chunk;
+        chunk  = next;
+    }
+    return true;
 }
 
 void *MemoryManager::allocRaw(size_t size, size_t align)
 {
-    // align is unused for now.
-    if(size == 0) return nullptr;
+    void *res = nullptr;
+    allocRawImpl(size, align, true, Span<void *>(&res, 1));
+    return res;
+}
+
+size_t MemoryManager::allocBatch(size_t size, size_t align, Span<void *> out)
+{
+    return allocRawImpl(size, align, true, out);
+}
+
+size_t MemoryManager::allocRawImpl(size_t size, size_t align, bool useSlab, Span<void *> out)
+{
+    std::fill(out.begin(), out.end(), nullptr);
+    if(size == 0 || out.empty()) return 0;
+    assert(std::has_single_bit(align) && "alignment must be a power of two");
+    // Also keeps the sizes below from wrapping around.
+    if(size > MAX_LARGE_CLASS_SIZE - ALLOC_DETAIL_BYTES) return 0;
+    if(align < MAX_ALIGNMENT) align = MAX_ALIGNMENT;
 
     // Add ALLOC_DETAIL_BYTES to the size since it is guaranteed
     // (static_assert) to be a multiple of MAX_ALIGNMENT.
     size_t requiredSz = size + ALLOC_DETAIL_BYTES;
-    size_t allocSz    = nextPow2(requiredSz);
+    size_t allocSz    = requiredSz;
+    if(requiredSz <= MAX_ROUNDUP) allocSz = SIZE_CLASSES[getSizeClass(requiredSz)];
 
-    LOG_TRACE("Allocating: ", allocSz, " (required size: ", requiredSz, ") (original size: ", size,
-              ")");
+    LOG_TRACE("Allocating: ", out.size(), " x ", allocSz, " (required size: ", requiredSz,
+              ") (original size: ", size, ")");
 
-    char *loc = nullptr;
+    useSlab       = useSlab && slabBegin && size <= SLAB_MAX_OBJECT && align <= SLAB_MAX_ALIGNMENT;
+    // Aligning within a pool needs up to (align - MAX_ALIGNMENT) bytes of padding.
+    bool useLarge = align > MAX_POOL_ALIGNMENT || isLargeAlloc(allocSz + align - MAX_ALIGNMENT);
+    bool borrowed = false;
+    // In MemFlags::LOCK_FREE mode, the arena is only used for its counters.
+    MemArena *arena = acquireThreadArena(borrowed);
+    if(arena->trimRequested.load(std::memory_order_relaxed)) trimArena(*arena);
 
-    ++totalAllocRequests;
-    if(allocSz > poolSize) {
-        totalAllocBytes += allocSz;
-        loc = (char *)AlignedAlloc(MAX_ALIGNMENT, allocSz);
-        LOG_TRACE("Allocated ", allocSz, " using malloc as it exceeds pool size: ", poolSize);
-    } else {
-        totalPoolAlloc += allocSz;
-        LockGuard<RecursiveMutex> mtxlock(mtx);
-        // there is a free chunk available in the chunk list
-        size_t &addrSz = freechunks[getFreeChunkIndex(allocSz)];
-        if(addrSz != 0) {
-            loc            = (char *)addrSz;
-            size_t nextTmp = getAllocDetail(addrSz, AllocDetails::NEXT);
-            setAllocDetail(addrSz, AllocDetails::NEXT, 0);
-            addrSz = nextTmp;
-            ++chunkReuseCount;
-            LOG_TRACE("Allocated ", allocSz, " using chunk list");
-            // No need to size size bytes here because they would have already been set
-            // when they were taken from the pool.
-            return loc;
-        }
-
-        // fetch a chunk from the pool
-        for(auto &p : pools) {
-            size_t freespace = poolSize - (p.head - p.mem);
-            if(freespace >= allocSz) {
-                loc = p.head;
-                p.head += allocSz;
-                LOG_TRACE("Allocated ", allocSz, " using existing pool");
-                break;
+    size_t alignIdx = getAlignClass(align);
+    size_t count    = 0;
+    if(useSlab) {
+        while(count < out.size() && (out[count] = allocSlab(*arena, size, align))) ++count;
+    }
+    if(count < out.size()) {
+        if(useLarge) {
+            while(count < out.size() &&
+                  (out[count] = allocLarge(requiredSz, align, arena->counters))) {
+                ++count;
             }
+        } else if(sharedArena) {
+            for(; count < out.size(); ++count) {
+                out[count] = allocLockFree(*sharedArena, allocSz, alignIdx, arena->counters);
+            }
+        } else {
+            count += allocFromArena(*arena, allocSz, alignIdx, out.subspan(count));
         }
-        if(!loc) {
-            allocPool();
-            auto &p = pools.back();
-            loc     = p.head;
-            p.head += allocSz;
-            LOG_TRACE("Allocated ", allocSz, " using a newly generated pool");
+    }
+    addTo(arena->counters.allocCount, count);
+    addTo(arena->counters.requestedBytes, size * count);
+    HeapProfiler *prof = profiler.load(std::memory_order_acquire);
+    if(prof) prof->onAlloc(arena->sampleCountdown, out.first(count), size);
+    if(borrowed) arena->owned.store(false, std::memory_order_release);
+    return count;
+}
+
+char *MemoryManager::allocLarge(size_t allocSz, size_t align, MemCounters &counters)
+{
+    align = std::max(align, MAX_ALIGNMENT);
+    // The AllocDetail goes right before the aligned address.
+    size_t offset  = std::max(align, ALLOC_DETAIL_BYTES);
+    if(allocSz > MAX_LARGE_CLASS_SIZE ||
+       offset - ALLOC_DETAIL_BYTES > MAX_LARGE_CLASS_SIZE - allocSz) {
+        return nullptr;
+    }
+    size_t idx     = calcSizeClass(allocSz + offset - ALLOC_DETAIL_BYTES);
+    size_t blockSz = calcClassSize(idx);
+    // aligned_alloc() requires the size to be a multiple of the alignment.
+    if(blockSz % align != 0) {
+        blockSz = (blockSz + align - 1) & ~(align - 1);
+        idx     = calcSizeClass(blockSz);
+    }
+    assert(calcClassSize(idx) == blockSz && "large blocks must be exactly their size class");
+
+    char *block = nullptr;
+    {
+        LockGuard<Mutex> lock(largeCacheMtx);
+        // Blocks of the class are usually aligned enough, but not always.
+        char **link = &largeCache[idx];
+        while(*link && (size_t)*link % align != 0) link = (char **)*link;
+        if((block = *link)) {
+            *link = *(char **)block;
+            largeCacheBytes -= blockSz;
         }
     }
-    loc += ALLOC_DETAIL_BYTES;
-    setAllocDetail((size_t)loc, AllocDetails::SIZE, allocSz);
+    if(block) {
+        addTo(counters.reuseCount, 1);
+        LOG_TRACE("Allocated ", blockSz, " using large cache");
+    } else {
+        block = mapLarge(blockSz, align);
+        if(!block) return nullptr;
+        LOG_TRACE("Allocated ", blockSz, " from OS as it exceeds pool size: ", poolSize,
+                  " or pool alignment: ", MAX_POOL_ALIGNMENT);
+    }
+    addTo(counters.allocBytes, blockSz);
+    char *loc = block + offset;
+    setAllocDetail((size_t)loc, AllocDetails::SIZE, blockSz);
     setAllocDetail((size_t)loc, AllocDetails::NEXT, 0);
+    setAllocDetail((size_t)loc, AllocDetails::DATA, (size_t)block | LARGE_ALLOC);
+    return loc;
+}
+
+void MemoryManager::freeLarge(char *loc)
+{
+    size_t blockSz = getAllocDetail((size_t)loc, AllocDetails::SIZE);
+    char *block    = (char *)(getAllocDetail((size_t)loc, AllocDetails::DATA) & ~DATA_TAG_MASK);
+    {
+        LockGuard<Mutex> lock(largeCacheMtx);
+        // Blocks carved from the file of a persistent manager can only be reused.
+        if(persistent || largeCacheBytes + blockSz <= largeCacheLimit) {
+            size_t idx      = calcSizeClass(blockSz);
+            *(char **)block = largeCache[idx];
+            largeCache[idx] = block;
+            largeCacheBytes += blockSz;
+            return;
+        }
+    }
+    unmapLarge(block, blockSz);
+}
+
+char *MemoryManager::remapLarge(char *loc, size_t newSize)
+{
+    size_t blockSz = getAllocDetail((size_t)loc, AllocDetails::SIZE);
+    char *block    = (char *)(getAllocDetail((size_t)loc, AllocDetails::DATA) & ~DATA_TAG_MASK);
+    size_t offset  = loc - block;
+    // Blocks from malloc (or a persistent manager's file) cannot be remapped, and moved blocks are
+    // only aligned to the page size.
+    if(persistent || blockSz < LARGE_MMAP_MIN || offset > vm::pageSize()) return nullptr;
+    if(newSize > MAX_LARGE_CLASS_SIZE - offset) return nullptr;
+    size_t newBlockSz = calcClassSize(calcSizeClass(newSize + offset));
+    char *newBlock    = (char *)vm::remap(block, blockSz, newBlockSz);
+    if(!newBlock) return nullptr;
+    if(newBlockSz >= HUGE_PAGE_SIZE) vm::adviseHugePages(newBlock, newBlockSz);
+    addOsBytes(newBlockSz - blockSz);
+    bool borrowed = false;
+    MemArena *own = acquireThreadArena(borrowed);
+    addTo(own->counters.allocBytes, newBlockSz - blockSz);
+    if(borrowed) own->owned.store(false, std::memory_order_release);
+    loc = newBlock + offset;
+    setAllocDetail((size_t)loc, AllocDetails::SIZE, newBlockSz);
+    setAllocDetail((size_t)loc, AllocDetails::DATA, (size_t)newBlock | LARGE_ALLOC);
+    LOG_TRACE("Remapped large allocation from ", blockSz, " to ", newBlockSz);
     return loc;
 }
 
+char *MemoryManager::mapLarge(size_t blockSz, size_t align)
+{
+    if(persistent) return carvePersistent(blockSz, align);
+    addOsBytes(blockSz);
+    if(blockSz < LARGE_MMAP_MIN) {
+        char *block = (char *)AlignedAlloc(align, blockSz);
+        if(!block) subOsBytes(blockSz);
+        return block;
+    }
+    // Huge pages can only back the parts of the block which are aligned to them.
+    bool huge   = blockSz >= HUGE_PAGE_SIZE;
+    if(huge) align = std::max(align, HUGE_PAGE_SIZE);
+    char *block = (char *)vm::reserveAligned(blockSz, align);
+    if(!block || !vm::commit(block, blockSz)) {
+        if(block) vm::release(block, blockSz);
+        subOsBytes(blockSz);
+        return nullptr;
+    }
+    if(huge) vm::adviseHugePages(block, blockSz);
+    return block;
+}
+
+void MemoryManager::unmapLarge(char *block, size_t blockSz)
+{
+    subOsBytes(blockSz);
+    if(blockSz < LARGE_MMAP_MIN) AlignedFree(block);
+    else vm::release(block, blockSz);
+}
+
+void MemoryManager::releaseLargeCache(size_t keepBytes)
+{
+    if(persistent) return;
+    // Release the largest blocks first.
+    for(size_t idx = LARGE_CLASS_COUNT; idx-- > 0 && largeCacheBytes > keepBytes;) {
+        size_t blockSz = calcClassSize(idx);
+        while(largeCache[idx] && largeCacheBytes > keepBytes) {
+            char *block     = largeCache[idx];
+            largeCache[idx] = *(char **)block;
+            largeCacheBytes -= blockSz;
+            unmapLarge(block, blockSz);
+        }
+    }
+}
+
+void MemoryManager::setLargeCacheLimit(size_t bytes)
+{
+    LockGuard<Mutex> lock(largeCacheMtx);
+    largeCacheLimit = bytes;
+    releaseLargeCache(bytes);
+}
+
+size_t MemoryManager::getLargeCacheBytes()
+{
+    LockGuard<Mutex> lock(largeCacheMtx);
+    return largeCacheBytes;
+}
+
+char *MemoryManager::carvePool(MemPool *pool, size_t allocSz, size_t align)
+{
+    char *head = pool->head.load(std::memory_order_relaxed);
+    size_t pad = alignPadding(head, align);
+    if(pool->size - (head - pool->mem) < pad + allocSz) return nullptr;
+    // Instead of wasting the padding, turn it into free chunks.
+    addFreeChunks(pool, head, pad);
+    head += pad;
+    pool->head.store(head + allocSz, std::memory_order_relaxed);
+    return head;
+}
+
+void MemoryManager::retirePool(MemPool *pool)
+{
+    char *head = pool->head.load(std::memory_order_relaxed);
+    addFreeChunks(pool, head, pool->size - (head - pool->mem));
+    pool->head.store(pool->mem + pool->size, std::memory_order_relaxed);
+}
+
+void MemoryManager::addFreeChunks(MemPool *pool, char *mem, size_t bytes)
+{
+    while(bytes >= MIN_CHUNK) {
+        size_t idx = getSizeClass(std::min(bytes, MAX_ROUNDUP));
+        if(SIZE_CLASSES[idx] > bytes) --idx;
+        size_t chunk   = (size_t)mem + ALLOC_DETAIL_BYTES;
+        size_t &addrSz = pool->arena->freechunks[0][idx];
+        addTo(pool->arena->counters.classFreeChunks[idx], 1);
+        setAllocDetail(chunk, AllocDetails::SIZE, SIZE_CLASSES[idx]);
+        setAllocDetail(chunk, AllocDetails::NEXT, addrSz);
+        setAllocDetail(chunk, AllocDetails::DATA, (size_t)pool);
+        addrSz = chunk;
+        mem += SIZE_CLASSES[idx];
+        bytes -= SIZE_CLASSES[idx];
+    }
+}
+
+size_t MemoryManager::allocFromArena(MemArena &arena, size_t allocSz, size_t alignIdx,
+                                     Span<void *> out)
+{
+    MemCounters &counters = arena.counters;
+    size_t classIdx       = getSizeClass(allocSz);
+    // take as many as possible from the chunk list
+    size_t &addrSz = arena.freechunks[alignIdx][classIdx];
+    if(addrSz == 0) collectRemoteFree(arena);
+    size_t count = 0;
+    while(count < out.size() && addrSz != 0) {
+        size_t chunk = addrSz;
+        addrSz       = getAllocDetail(chunk, AllocDetails::NEXT);
+        setAllocDetail(chunk, AllocDetails::NEXT, 0);
+        addTo(poolOf(getAllocDetail(chunk, AllocDetails::DATA))->live, 1);
+        // No need to size size bytes here because they would have already been set
+        // when they were taken from the pool.
+        out[count++] = (char *)chunk;
+    }
+    if(count > 0) {
+        addTo(counters.reuseCount, count);
+        subFrom(counters.classFreeChunks[classIdx], count);
+        LOG_TRACE("Allocated ", count, " x ", allocSz, " using chunk list");
+    }
+
+    // fetch the rest from the current pool
+    // Only the owner modifies the pools, so no lock is required to read them here.
+    size_t align  = MAX_ALIGNMENT << alignIdx;
+    MemPool *pool = arena.current.load(std::memory_order_relaxed);
+    for(; count < out.size(); ++count) {
+        char *loc = nullptr;
+        if(pool && (loc = carvePool(pool, allocSz, align))) {
+            LOG_TRACE("Allocated ", allocSz, " using existing pool");
+        } else {
+            // The rest of the pool would never be used otherwise.
+            if(pool) retirePool(pool);
+            LockGuard<Mutex> lock(arena.mtx);
+            if(!(pool = allocPool(arena))) break;
+            loc = carvePool(pool, allocSz, align);
+            LOG_TRACE("Allocated ", allocSz, " using a newly generated pool");
+        }
+        addTo(pool->live, 1);
+        loc += ALLOC_DETAIL_BYTES;
+        setAllocDetail((size_t)loc, AllocDetails::SIZE, allocSz);
+        setAllocDetail((size_t)loc, AllocDetails::NEXT, 0);
+        setAllocDetail((size_t)loc, AllocDetails::DATA, (size_t)pool | alignIdx);
+        out[count] = loc;
+    }
+    addTo(counters.allocBytes, allocSz * count);
+    addTo(counters.classAllocs[classIdx], count);
+    return count;
+}
+
 void MemoryManager::freeRaw(void *data)
 {
     if(data == nullptr) return;
+    HeapProfiler *prof = profiler.load(std::memory_order_acquire);
+    if(prof) prof->onFree(data);
     char *loc = (char *)data;
-    size_t sz = getAllocDetail((size_t)loc, AllocDetails::SIZE);
-    if(sz > poolSize) {
-        AlignedFree(loc - ALLOC_DETAIL_BYTES);
+    if(isSlabAlloc(loc)) {
+        freeSlab(loc);
         return;
     }
-    LockGuard<RecursiveMutex> mtxlock(mtx);
-    size_t idx     = getFreeChunkIndex(sz);
-    size_t &addrSz = freechunks[idx];
+    size_t sz       = getAllocDetail((size_t)loc, AllocDetails::SIZE);
+    size_t detail   = getAllocDetail((size_t)loc, AllocDetails::DATA);
+    size_t alignIdx = detail & DATA_TAG_MASK;
+    if(alignIdx == LARGE_ALLOC) {
+        freeLarge(loc);
+        bool borrowed = false;
+        MemArena *own = acquireThreadArena(borrowed);
+        addTo(own->counters.freeCount, 1);
+        addTo(own->counters.freedBytes, sz);
+        if(borrowed) own->owned.store(false, std::memory_order_release);
+        return;
+    }
+    MemPool *pool   = poolOf(detail);
+    MemArena *arena = pool->arena;
+    if(arena == sharedArena) {
+        size_t idx = getSizeClass(sz);
+        pushChunk(arena->sharedchunks[alignIdx][idx], (size_t)loc);
+        bool borrowed = false;
+        MemArena *own = acquireThreadArena(borrowed);
+        addTo(own->counters.freeCount, 1);
+        addTo(own->counters.freedBytes, sz);
+        addTo(own->counters.classFrees[idx], 1);
+        addTo(own->counters.classFreeChunks[idx], 1);
+        if(borrowed) own->owned.store(false, std::memory_order_release);
+        return;
+    }
+    if(arena == getThreadArena()) {
+        freeToArena(*arena, loc);
+        return;
+    }
+    // Allocation belongs to some other thread's arena, hand it back to that.
+    pushRemoteFree(*arena, (size_t)loc, (size_t)loc);
+}
+
+void MemoryManager::pushRemoteFree(MemArena &arena, size_t head, size_t tail)
+{
+    size_t oldHead = arena.remoteFree.load(std::memory_order_relaxed);
+    do {
+        setRemoteNext(tail, oldHead);
+    } while(!arena.remoteFree.compare_exchange_weak(oldHead, head, std::memory_order_release,
+                                                    std::memory_order_relaxed));
+}
+
+void *MemoryManager::reallocRaw(void *data, size_t newSize)
+{
+    if(data == nullptr) return allocRaw(newSize, MAX_ALIGNMENT);
+    if(newSize == 0) {
+        freeRaw(data);
+        return nullptr;
+    }
+    // The allocation is left as is, like when the new one cannot be made.
+    if(newSize > MAX_LARGE_CLASS_SIZE - ALLOC_DETAIL_BYTES) return nullptr;
+    char *loc     = (char *)data;
+    size_t usable = 0;
+    size_t align  = 0;
+    if(isSlabAlloc(loc)) {
+        MemSlab *slab = (MemSlab *)((size_t)loc & ~(SLAB_SIZE - 1));
+        if(newSize <= slab->objSize) return resizeSample(loc, loc, newSize);
+        // Slab objects are aligned to their size, see allocSlab().
+        usable = slab->objSize;
+        align  = std::min((size_t)slab->objSize & (0 - (size_t)slab->objSize), SLAB_MAX_ALIGNMENT);
+    } else {
+        size_t sz     = getAllocDetail((size_t)loc, AllocDetails::SIZE);
+        size_t detail = getAllocDetail((size_t)loc, AllocDetails::DATA);
+        if((detail & DATA_TAG_MASK) == LARGE_ALLOC) {
+            // Large allocations start this far into their block, see allocLarge().
+            size_t offset = loc - (char *)(detail & ~DATA_TAG_MASK);
+            if(newSize + offset <= sz) return resizeSample(loc, loc, newSize);
+            if(char *res = remapLarge(loc, newSize)) return resizeSample(loc, res, newSize);
+            usable = sz - offset;
+            align  = offset;
+        } else {
+            if(newSize + ALLOC_DETAIL_BYTES <= sz || growInPool(loc, newSize)) {
+                return resizeSample(loc, loc, newSize);
+            }
+            usable = sz - ALLOC_DETAIL_BYTES;
+            align  = MAX_ALIGNMENT << (detail & DATA_TAG_MASK);
+        }
+    }
+    void *res = allocRaw(newSize, align);
+    if(!res) return nullptr;
+    memcpy(res, loc, usable);
+    freeRaw(loc);
+    return res;
+}
+
+char *MemoryManager::resizeSample(char *loc, char *newLoc, size_t newSize)
+{
+    HeapProfiler *prof = profiler.load(std::memory_order_acquire);
+    if(prof) prof->onResize(loc, newLoc, newSize);
+    return newLoc;
+}
+
+bool MemoryManager::growInPool(char *loc, size_t newSize)
+{
+    size_t sz       = getAllocDetail((size_t)loc, AllocDetails::SIZE);
+    size_t detail   = getAllocDetail((size_t)loc, AllocDetails::DATA);
+    MemPool *pool   = poolOf(detail);
+    MemArena *arena = pool->arena;
+    // Only the owner carves its current pool (and the head is shared in MemFlags::LOCK_FREE mode).
+    if(arena == sharedArena || arena != getThreadArena()) return false;
+    if(arena->current.load(std::memory_order_relaxed) != pool) return false;
+    size_t requiredSz = newSize + ALLOC_DETAIL_BYTES;
+    if(requiredSz > MAX_ROUNDUP) return false;
+    size_t newSz = SIZE_CLASSES[getSizeClass(requiredSz)];
+    size_t align = MAX_ALIGNMENT << (detail & DATA_TAG_MASK);
+    if(isLargeAlloc(newSz + align - MAX_ALIGNMENT)) return false;
+    char *start = loc - ALLOC_DETAIL_BYTES;
+    if(pool->head.load(std::memory_order_relaxed) != start + sz) return false;
+    if(start + newSz > pool->mem + pool->size) return false;
+    pool->head.store(start + newSz, std::memory_order_relaxed);
+    setAllocDetail((size_t)loc, AllocDetails::SIZE, newSz);
+    // The allocation moves to the new size class, which is the one counted when it is freed.
+    MemCounters &counters = arena->counters;
+    addTo(counters.allocBytes, newSz - sz);
+    subFrom(counters.classAllocs[getSizeClass(sz)], 1);
+    addTo(counters.classAllocs[getSizeClass(newSz)], 1);
+    LOG_TRACE("Grew allocation from ", sz, " to ", newSz, " at the pool head");
+    return true;
+}
+
+void MemoryManager::freeToArena(MemArena &arena, char *loc)
+{
+    size_t sz      = getAllocDetail((size_t)loc, AllocDetails::SIZE);
+    size_t detail  = getAllocDetail((size_t)loc, AllocDetails::DATA);
+    size_t idx     = getSizeClass(sz);
+    size_t &addrSz = arena.freechunks[detail & DATA_TAG_MASK][idx];
     setAllocDetail((size_t)loc, AllocDetails::NEXT, addrSz);
     addrSz = (size_t)loc;
+    subFrom(poolOf(detail)->live, 1);
+    addTo(arena.counters.freeCount, 1);
+    addTo(arena.counters.freedBytes, sz);
+    addTo(arena.counters.classFrees[idx], 1);
+    addTo(arena.counters.classFreeChunks[idx], 1);
+}
+
+void MemoryManager::freeBatch(Span<void *> allocs)
+{
+    // Allocations of other threads' arenas, chained up (the same way as remoteFree) to be pushed
+    // to each arena in one go.
+    struct RemoteChain
+    {
+        MemArena *arena;
+        size_t head;
+        size_t tail;
+    };
+    Array<RemoteChain, 8> chains;
+    size_t chainCount = 0;
+    auto spliceChains = [&]() {
+        for(size_t i = 0; i < chainCount; ++i) {
+            pushRemoteFree(*chains[i].arena, chains[i].head, chains[i].tail);
+        }
+        chainCount = 0;
+    };
+
+    MemArena *own      = getThreadArena();
+    HeapProfiler *prof = profiler.load(std::memory_order_acquire);
+    for(void *data : allocs) {
+        if(data == nullptr) continue;
+        if(prof) prof->onFree(data);
+        char *loc       = (char *)data;
+        MemArena *arena = nullptr;
+        if(isSlabAlloc(loc)) {
+            arena = ((MemSlab *)((size_t)loc & ~(SLAB_SIZE - 1)))->arena;
+            if(arena == own) {
+                releaseSlabObject(*arena, loc);
+                continue;
+            }
+        } else {
+            size_t detail = getAllocDetail((size_t)loc, AllocDetails::DATA);
+            // Large and lock-free allocations gain nothing from being batched.
+            if((detail & DATA_TAG_MASK) == LARGE_ALLOC || poolOf(detail)->arena == sharedArena) {
+                freeRaw(loc);
+                continue;
+            }
+            arena = poolOf(detail)->arena;
+            if(arena == own) {
+                freeToArena(*arena, loc);
+                continue;
+            }
+        }
+        RemoteChain *chain = nullptr;
+        for(size_t i = 0; i < chainCount && !chain; ++i) {
+            if(chains[i].arena == arena) chain = &chains[i];
+        }
+        if(!chain) {
+            if(chainCount == chains.size()) spliceChains();
+            chain  = &chains[chainCount++];
+            *chain = {arena, 0, (size_t)loc};
+        }
+        setRemoteNext((size_t)loc, chain->head);
+        chain->head = (size_t)loc;
+    }
+    spliceChains();
+}
+
+static void linkSlab(MemArena &arena, MemSlab *slab)
+{
+    MemSlab *&head = arena.slabs[slab->classIdx];
+    slab->prev     = nullptr;
+    slab->next     = head;
+    if(head) head->prev = slab;
+    head         = slab;
+    slab->listed = true;
 }
 
-void MemoryManager::dumpMem(char *pool)
+static void unlinkSlab(MemArena &arena, MemSlab *slab)
 {
-    constexpr size_t charSize     = 2; // in bytes
-    constexpr size_t charsPerLine = 64 * charSize;
-    for(size_t i = 0; i < poolSize; i += charSize) {
-        if(i % charsPerLine == 0) std::cout << "\n" << (void *)(pool + i) << " :: ";
-        std::cout << std::hex << (*(uint16_t *)(pool + i)) << " ";
+    if(slab->prev) slab->prev->next = slab->next;
+    else arena.slabs[slab->classIdx] = slab->next;
+    if(slab->next) slab->next->prev = slab->prev;
+    slab->next   = nullptr;
+    slab->prev   = nullptr;
+    slab->listed = false;
+}
+
+char *MemoryManager::allocSlab(MemArena &arena, size_t size, size_t align)
+{
+    size_t classIdx = getSizeClass(size);
+    // Objects are aligned to their size (upto SLAB_MAX_ALIGNMENT), see SLAB_HEADER_BYTES.
+    while(SIZE_CLASSES[classIdx] % align != 0) ++classIdx;
+    MemSlab *slab   = arena.slabs[classIdx];
+    // Objects freed by other threads may give a slab with free objects.
+    if(!slab && collectRemoteFree(arena)) slab = arena.slabs[classIdx];
+    if(!slab && !(slab = newSlab(arena, classIdx))) return nullptr;
+
+    char *obj = slab->freeObj;
+    if(obj) {
+        slab->freeObj = *(char **)obj;
+        addTo(arena.counters.reuseCount, 1);
+    } else {
+        obj = slab->bump;
+        slab->bump += slab->objSize;
+    }
+    ++slab->used;
+    // Full slabs are taken out of the list, and put back when an object is freed.
+    if(!slab->freeObj && slab->bump + slab->objSize > (char *)slab + SLAB_SIZE) {
+        unlinkSlab(arena, slab);
+    }
+    addTo(arena.counters.allocBytes, slab->objSize);
+    addTo(arena.counters.classAllocs[classIdx], 1);
+    LOG_TRACE("Allocated ", (size_t)slab->objSize, " using slab (original size: ", size, ")");
+    return obj;
+}
+
+MemSlab *MemoryManager::newSlab(MemArena &arena, size_t classIdx)
+{
+    MemSlab *slab = arena.emptySlabs;
+    if(slab) {
+        arena.emptySlabs = slab->next;
+    } else if(purgedSlabCount.load(std::memory_order_relaxed) > 0) {
+        LockGuard<Mutex> lock(purgedSlabsMtx);
+        if(!purgedSlabs.empty()) {
+            slab = purgedSlabs.back();
+            purgedSlabs.pop_back();
+            --purgedSlabCount;
+            addOsBytes(SLAB_SIZE);
+        }
+    }
+    if(!slab) {
+        size_t offset = slabsUsed.fetch_add(SLAB_SIZE, std::memory_order_relaxed);
+        if(offset + SLAB_SIZE > SLAB_RESERVE) {
+            LOG_TRACE("Slab space exhausted for manager: ", name);
+            return nullptr;
+        }
+        if(!vm::commit(slabBegin + offset, SLAB_SIZE)) return nullptr;
+        addOsBytes(SLAB_SIZE);
+        slab = (MemSlab *)(slabBegin + offset);
     }
-    std::cout << std::dec << "\n";
+    slab->arena    = &arena;
+    slab->freeObj  = nullptr;
+    slab->bump     = (char *)slab + SLAB_HEADER_BYTES;
+    slab->objSize  = SIZE_CLASSES[classIdx];
+    slab->classIdx = classIdx;
+    slab->used     = 0;
+    linkSlab(arena, slab);
+    return slab;
 }
 
+void MemoryManager::freeSlab(char *obj)
+{
+    MemSlab *slab   = (MemSlab *)((size_t)obj & ~(SLAB_SIZE - 1));
+    MemArena *arena = slab->arena;
+    if(arena == getThreadArena()) {
+        releaseSlabObject(*arena, obj);
+        return;
+    }
+    pushRemoteFree(*arena, (size_t)obj, (size_t)obj);
+}
+
+void MemoryManager::releaseSlabObject(MemArena &arena, char *obj)
+{
+    MemSlab *slab = (MemSlab *)((size_t)obj & ~(SLAB_SIZE - 1));
+    *(char **)obj = slab->freeObj;
+    slab->freeObj = obj;
+    --slab->used;
+    addTo(arena.counters.freeCount, 1);
+    addTo(arena.counters.freedBytes, slab->objSize);
+    addTo(arena.counters.classFrees[slab->classIdx], 1);
+    if(!slab->listed) linkSlab(arena, slab);
+    // Empty slabs can be reused for any class, but keep one around for this class anyway.
+    if(slab->used == 0 && (slab->prev || slab->next)) {
+        unlinkSlab(arena, slab);
+        slab->next       = arena.emptySlabs;
+        arena.emptySlabs = slab;
+    }
+}
+
+void *MemoryManager::allocListRaw(size_t size, size_t align)
+{
+    // The links are placed right before the object, so keep the object aligned.
+    size_t prefix = std::max(LIST_LINK_BYTES, align);
+    if(!slabBegin || size + prefix > SLAB_MAX_OBJECT || align > SLAB_MAX_ALIGNMENT) {
+        void *res = nullptr;
+        allocRawImpl(size, align, false, Span<void *>(&res, 1));
+        return res;
+    }
+    void *res = nullptr;
+    allocRawImpl(size + prefix, align, true, Span<void *>(&res, 1));
+    char *alloc = (char *)res;
+    // Slab space may have run out, in which case the allocation has an AllocDetail for the links.
+    return isSlabAlloc(alloc) ? alloc + prefix : alloc;
+}
+
+void MemoryManager::freeListRaw(void *data)
+{
+    char *loc = (char *)data;
+    if(isSlabAlloc(loc)) {
+        // Go back to the start of the slab object.
+        MemSlab *slab = (MemSlab *)((size_t)loc & ~(SLAB_SIZE - 1));
+        char *objs    = (char *)slab + SLAB_HEADER_BYTES;
+        loc           = objs + (loc - objs) / slab->objSize * slab->objSize;
+    }
+    freeRaw(loc);
+}
+
+void MemoryManager::freeListBatch(Span<void *> allocs)
+{
+    for(void *&data : allocs) {
+        char *loc = (char *)data;
+        if(!isSlabAlloc(loc)) continue;
+        MemSlab *slab = (MemSlab *)((size_t)loc & ~(SLAB_SIZE - 1));
+        char *objs    = (char *)slab + SLAB_HEADER_BYTES;
+        data          = objs + (loc - objs) / slab->objSize * slab->objSize;
+    }
+    freeBatch(allocs);
+}
+
+char *MemoryManager::allocLockFree(MemArena &arena, size_t allocSz, size_t alignIdx,
+                                   MemCounters &counters)
+{
+    size_t classIdx = getSizeClass(allocSz);
+    addTo(counters.allocBytes, allocSz);
+    addTo(counters.classAllocs[classIdx], 1);
+    size_t chunk = popChunk(arena.sharedchunks[alignIdx][classIdx]);
+    if(chunk != 0) {
+        chunkNext(chunk).store(0, std::memory_order_relaxed);
+        addTo(counters.reuseCount, 1);
+        subFrom(counters.classFreeChunks[classIdx], 1);
+        LOG_TRACE("Allocated ", allocSz, " using chunk list");
+        return (char *)chunk;
+    }
+
+    char *loc    = nullptr;
+    size_t align = MAX_ALIGNMENT << alignIdx;
+    MemPool *p   = nullptr;
+    while(true) {
+        p = arena.current.load(std::memory_order_acquire);
+        if(alignIdx == 0) {
+            // Once head goes past the end of the pool, every thread allocating from it fails and
+            // moves on to the next pool.
+            loc = p->head.fetch_add(allocSz, std::memory_order_relaxed);
+            if(loc + allocSz <= p->mem + p->size) break;
+        } else {
+            // The padding depends on head, so it must not move in the meantime.
+            // The padding is wasted as carving it into chunks would need more atomic operations.
+            loc         = p->head.load(std::memory_order_relaxed);
+            char *start = nullptr;
+            do {
+                start = loc + alignPadding(loc, align);
+            } while(start + allocSz <= p->mem + p->size &&
+                    !p->head.compare_exchange_weak(loc, start + allocSz,
+                                                   std::memory_order_relaxed));
+            if(start + allocSz <= p->mem + p->size) {
+                loc = start;
+                break;
+            }
+        }
+        LockGuard<Mutex> lock(arena.mtx);
+        // Some other thread may have already added a pool.
+        if(arena.current.load(std::memory_order_relaxed) != p) continue;
+        allocPool(arena);
+        LOG_TRACE("Generated a new pool for lock-free allocations");
+    }
+    loc += ALLOC_DETAIL_BYTES;
+    setAllocDetail((size_t)loc, AllocDetails::SIZE, allocSz);
+    setAllocDetail((size_t)loc, AllocDetails::NEXT, 0);
+    setAllocDetail((size_t)loc, AllocDetails::DATA, (size_t)p | alignIdx);
+    return loc;
+}
+
+void MemoryManager::pushChunk(Atomic<uint64_t> &head, size_t chunk)
+{
+    std::atomic_ref<size_t> next = chunkNext(chunk);
+    uint64_t oldHead             = head.load(std::memory_order_relaxed);
+    uint64_t newHead             = 0;
+    do {
+        next.store(oldHead & TAG_ADDRESS, std::memory_order_relaxed);
+        newHead = ((oldHead & ~TAG_ADDRESS) + TAG_ONE) | chunk;
+    } while(!head.compare_exchange_weak(oldHead, newHead, std::memory_order_release,
+                                        std::memory_order_relaxed));
+}
+
+size_t MemoryManager::popChunk(Atomic<uint64_t> &head)
+{
+    uint64_t oldHead = head.load(std::memory_order_acquire);
+    while(oldHead & TAG_ADDRESS) {
+        size_t chunk = oldHead & TAG_ADDRESS;
+        // The chunk may be popped (and even reused) by another thread before this is read. Pools
+        // are never freed while the manager is alive, so the read is safe and the stale value is
+        // discarded as the tag would have changed.
+        std::atomic_ref<size_t> next = chunkNext(chunk);
+        uint64_t newHead =
+            ((oldHead & ~TAG_ADDRESS) + TAG_ONE) | next.load(std::memory_order_relaxed);
+        bool popped = head.compare_exchange_weak(oldHead, newHead, std::memory_order_acquire,
+                                                 std::memory_order_acquire);
+        if(popped) return chunk;
+    }
+    return 0;
+}
+
+size_t MemoryManager::getPoolCount()
+{
+    size_t count = 0;
+    LockGuard<Mutex> lock(arenasMtx);
+    for(auto &a : arenas) {
+        LockGuard<Mutex> arenaLock(a->mtx);
+        count += a->pools.size();
+    }
+    return count;
+}
+
+size_t MemoryManager::getArenaCount()
+{
+    LockGuard<Mutex> lock(arenasMtx);
+    return arenas.size();
+}
+
+MemStats MemoryManager::stats()
+{
+    MemStats res{};
+    auto load = [](const Atomic<size_t> &counter) {
+        return counter.load(std::memory_order_relaxed);
+    };
+    {
+        LockGuard<Mutex> lock(arenasMtx);
+        for(auto &a : arenas) {
+            MemCounters &c = a->counters;
+            res.allocCount += load(c.allocCount);
+            res.freeCount += load(c.freeCount);
+            res.reuseCount += load(c.reuseCount);
+            res.requestedBytes += load(c.requestedBytes);
+            res.allocBytes += load(c.allocBytes);
+            res.freedBytes += load(c.freedBytes);
+            for(size_t i = 0; i < SIZE_CLASS_COUNT; ++i) {
+                res.sizeClasses[i].allocCount += load(c.classAllocs[i]);
+                res.sizeClasses[i].freeCount += load(c.classFrees[i]);
+                res.sizeClasses[i].freeChunks += load(c.classFreeChunks[i]);
+            }
+            LockGuard<Mutex> arenaLock(a->mtx);
+            res.poolCount += a->pools.size();
+        }
+        res.arenaCount = arenas.size();
+    }
+    res.liveBytes       = res.allocBytes - res.freedBytes;
+    res.osBytes         = load(osBytes);
+    res.peakOsBytes     = load(peakOsBytes);
+    res.largeCacheBytes = getLargeCacheBytes();
+    res.slabCount       = getSlabCount();
+    return res;
+}
+
+size_t MemoryManager::trimArena(MemArena &arena)
+{
+    arena.trimRequested.store(false, std::memory_order_relaxed);
+    collectRemoteFree(arena);
+    // All the chunks of pools without live allocations are in the free chunk lists, drop them.
+    for(auto &lists : arena.freechunks) {
+        for(auto &list : lists) {
+            size_t prev = 0;
+            for(size_t chunk = list, next = 0; chunk != 0; chunk = next) {
+                next = getAllocDetail(chunk, AllocDetails::NEXT);
+                MemPool *pool = poolOf(getAllocDetail(chunk, AllocDetails::DATA));
+                if(pool->live.load(std::memory_order_relaxed) == 0) {
+                    subFrom(arena.counters.classFreeChunks[&list - lists.data()], 1);
+                    continue;
+                }
+                if(prev) setAllocDetail(prev, AllocDetails::NEXT, chunk);
+                else list = chunk;
+                prev = chunk;
+            }
+            if(prev) setAllocDetail(prev, AllocDetails::NEXT, 0);
+            else list = 0;
+        }
+    }
+
+    size_t released  = 0;
+    MemPool *current = arena.current.load(std::memory_order_relaxed);
+    {
+        LockGuard<Mutex> lock(arena.mtx);
+        std::erase_if(arena.pools, [&](MemPool *p) {
+            if(p->live.load(std::memory_order_relaxed) != 0 || p == current) return false;
+            released += p->size;
+            subOsBytes(p->size);
+            AlignedFree(p->mem);
+            delete p;
+            return true;
+        });
+    }
+    // The current pool is kept, but is carved from the start again.
+    if(current && current->live.load(std::memory_order_relaxed) == 0) {
+        current->head.store(current->mem, std::memory_order_relaxed);
+    }
+
+    if(!arena.emptySlabs) return released;
+    Vector<MemSlab *> slabs;
+    for(MemSlab *slab = arena.emptySlabs; slab; slab = slab->next) slabs.push_back(slab);
+    arena.emptySlabs = nullptr;
+    // The slab headers are gone after purging, so the slabs are kept track of separately.
+    for(auto &slab : slabs) vm::purge(slab, SLAB_SIZE);
+    released += slabs.size() * SLAB_SIZE;
+    subOsBytes(slabs.size() * SLAB_SIZE);
+    LockGuard<Mutex> lock(purgedSlabsMtx);
+    purgedSlabs.insert(purgedSlabs.end(), slabs.begin(), slabs.end());
+    purgedSlabCount += slabs.size();
+    return released;
+}
+
+size_t MemoryManager::trim()
+{
+    if(persistent) return 0;
+    size_t released = 0;
+    if(!sharedArena) {
+        MemArena *own = getThreadArena();
+        LockGuard<Mutex> lock(arenasMtx);
+        for(auto &a : arenas) {
+            if(a == own) {
+                released += trimArena(*a);
+                continue;
+            }
+            // Unowned arenas can be trimmed right away, as long as no thread adopts them meanwhile.
+            bool expected = false;
+            if(a->owned.compare_exchange_strong(expected, true, std::memory_order_acquire)) {
+                released += trimArena(*a);
+                a->owned.store(false, std::memory_order_release);
+                continue;
+            }
+            a->trimRequested.store(true, std::memory_order_relaxed);
+        }
+    }
+    LockGuard<Mutex> lock(largeCacheMtx);
+    released += largeCacheBytes;
+    releaseLargeCache(0);
+    LOG_TRACE("Trimmed ", released, " bytes from manager: ", name);
+    return released;
+}
+
+void MemoryManager::setTrimInterval(std::chrono::milliseconds interval)
+{
+    if(trimThread.joinable()) {
+        trimThread.request_stop();
+        trimThread.join();
+    }
+    if(interval.count() == 0) return;
+    trimThread = JThread([this, interval](std::stop_token stop) {
+        Mutex mtx;
+        CondVar cv;
+        std::unique_lock<Mutex> lock(mtx);
+        while(!cv.wait_for(lock, stop, interval, [&stop] { return stop.stop_requested(); })) {
+            trim();
+        }
+    });
+}
+
+void MemoryManager::setSampleInterval(size_t bytes)
+{
+    HeapProfiler *prof = profiler.load(std::memory_order_acquire);
+    if(prof) {
+        prof->setInterval(bytes);
+        return;
+    }
+    if(bytes == 0) return;
+    prof = new HeapProfiler(bytes);
+    HeapProfiler *expected = nullptr;
+    if(!profiler.compare_exchange_strong(expected, prof, std::memory_order_acq_rel)) {
+        // Another thread enabled it in the meantime.
+        delete prof;
+        expected->setInterval(bytes);
+    }
+}
+
+bool MemoryManager::writeProfile(OStream &os, ProfileFormat format)
+{
+    HeapProfiler *prof = profiler.load(std::memory_order_acquire);
+    return prof && prof->write(os, format);
+}
+
+HeapMap MemoryManager::heapMap()
+{
+    HeapMap map         = {};
+    MemStats s          = stats();
+    map.slabCount       = s.slabCount;
+    map.slabBytes       = s.slabCount * SLAB_SIZE;
+    map.largeCacheBytes = s.largeCacheBytes;
+    map.sizeClasses     = s.sizeClasses;
+    size_t liveBytes    = 0;
+    for(size_t i = 0; i < SIZE_CLASS_COUNT; ++i) {
+        liveBytes += (s.sizeClasses[i].allocCount - s.sizeClasses[i].freeCount) * SIZE_CLASSES[i];
+    }
+    size_t usedBytes = map.slabBytes;
+    LockGuard<Mutex> lock(arenasMtx);
+    for(auto &a : arenas) {
+        HeapArenaInfo &info = map.arenas.emplace_back();
+        info.owned          = a->owned.load(std::memory_order_relaxed);
+        size_t freeBytes    = 0;
+        for(size_t i = 0; i < SIZE_CLASS_COUNT; ++i) {
+            info.freeChunks[i] = a->counters.classFreeChunks[i].load(std::memory_order_relaxed);
+            freeBytes += info.freeChunks[i] * SIZE_CLASSES[i];
+        }
+        size_t arenaUsed = 0;
+        {
+            LockGuard<Mutex> arenaLock(a->mtx);
+            for(auto &p : a->pools) {
+                // The head goes past the end of the pool in MemFlags::LOCK_FREE mode.
+                size_t used = std::min<size_t>(p->head.load(std::memory_order_relaxed) - p->mem,
+                                               p->size);
+                info.pools.push_back({(size_t)p->mem, p->size, used,
+                                      p->live.load(std::memory_order_relaxed)});
+                arenaUsed += used;
+            }
+        }
+        usedBytes += arenaUsed;
+        if(arenaUsed > 0) info.fragmentation = std::min((double)freeBytes / arenaUsed, 1.0);
+    }
+    if(usedBytes > 0) map.fragmentation = std::max(1.0 - (double)liveBytes / usedBytes, 0.0);
+    return map;
+}
+
+static void writeJsonString(OStream &os, StringRef str)
+{
+    constexpr const char *hex = "0123456789abcdef";
+    os << '"';
+    for(char c : str) {
+        if(c == '"' || c == '\\') os << '\\' << c;
+        else if((unsigned char)c < 0x20) os << "\\u00" << hex[c >> 4] << hex[c & 15];
+        else os << c;
+    }
+    os << '"';
+}
+
+// Little endian, regardless of the host.
+static void writeU64(OStream &os, uint64_t v)
+{
+    char buf[8];
+    for(size_t i = 0; i < 8; ++i) buf[i] = (char)(v >> (i * 8));
+    os.write(buf, 8);
+}
+
+bool MemoryManager::writeHeapMap(OStream &os, HeapMapFormat format)
+{
+    HeapMap map = heapMap();
+    if(format == HeapMapFormat::BINARY) {
+        os.write("LCHM", 4);
+        for(size_t i = 0; i < 4; ++i) os.put((char)(HEAP_MAP_VERSION >> (i * 8)));
+        writeU64(os, map.slabCount);
+        writeU64(os, map.slabBytes);
+        writeU64(os, map.largeCacheBytes);
+        writeU64(os, std::bit_cast<uint64_t>(map.fragmentation));
+        writeU64(os, SIZE_CLASS_COUNT);
+        for(size_t i = 0; i < SIZE_CLASS_COUNT; ++i) {
+            writeU64(os, SIZE_CLASSES[i]);
+            writeU64(os, map.sizeClasses[i].allocCount);
+            writeU64(os, map.sizeClasses[i].freeCount);
+            writeU64(os, map.sizeClasses[i].freeChunks);
+        }
+        writeU64(os, map.arenas.size());
+        for(auto &a : map.arenas) {
+            writeU64(os, a.owned);
+            writeU64(os, std::bit_cast<uint64_t>(a.fragmentation));
+            for(auto &c : a.freeChunks) writeU64(os, c);
+            writeU64(os, a.pools.size());
+            for(auto &p : a.pools) {
+                writeU64(os, p.address);
+                writeU64(os, p.size);
+                writeU64(os, p.used);
+                writeU64(os, p.live);
+            }
+        }
+        return (bool)os;
+    }
+
+    os << "{\"name\":";
+    writeJsonString(os, name);
+    os << ",\"slabCount\":" << map.slabCount << ",\"slabBytes\":" << map.slabBytes
+       << ",\"largeCacheBytes\":" << map.largeCacheBytes
+       << ",\"fragmentation\":" << map.fragmentation << ",\"sizeClasses\":[";
+    for(size_t i = 0; i < SIZE_CLASS_COUNT; ++i) {
+        MemSizeClassStats &c = map.sizeClasses[i];
+        os << (i ? "," : "") << "{\"size\":" << SIZE_CLASSES[i]
+           << ",\"allocCount\":" << c.allocCount << ",\"freeCount\":" << c.freeCount
+           << ",\"freeChunks\":" << c.freeChunks << "}";
+    }
+    os << "],\"arenas\":[";
+    for(size_t i = 0; i < map.arenas.size(); ++i) {
+        HeapArenaInfo &a = map.arenas[i];
+        os << (i ? "," : "") << "{\"owned\":" << (a.owned ? "true" : "false")
+           << ",\"fragmentation\":" << a.fragmentation << ",\"freeChunks\":[";
+        for(size_t c = 0; c < SIZE_CLASS_COUNT; ++c) os << (c ? "," : "") << a.freeChunks[c];
+        os << "],\"pools\":[";
+        for(size_t p = 0; p < a.pools.size(); ++p) {
+            HeapPoolInfo &pool = a.pools[p];
+            os << (p ? "," : "") << "{\"address\":" << pool.address << ",\"size\":" << pool.size
+               << ",\"used\":" << pool.used << ",\"live\":" << pool.live << "}";
+        }
+        os << "]}";
+    }
+    os << "]}\n";
+    return (bool)os;
+}
+
+bool MemoryManager::openPersistent(const Path &file, size_t capacity, size_t base)
+{
+    // An existing file is mapped with the capacity and at the base it was created with.
+    std::error_code ec;
+    bool reopen = fs::file_size(file, ec) > 0 && !ec;
+    if(reopen) {
+        PersistentHeader saved;
+        IFStream in(file, std::ios::binary);
+        if(!in.read((char *)&saved, sizeof(saved)) || saved.magic != PERSISTENT_MAGIC ||
+           saved.version != PERSISTENT_VERSION || saved.headerBytes != sizeof(PersistentHeader)) {
+            LOG_WARN("File ", file,
+                     " is not a compatible persistent heap, not using it for manager: ", name);
+            return false;
+        }
+        capacity = saved.capacity;
+        base     = saved.base;
+    }
+    capacity  = (capacity + PERSISTENT_GRANULE - 1) & ~(PERSISTENT_GRANULE - 1);
+    capacity  = std::max(capacity, 2 * PERSISTENT_HEADER_BYTES);
+    char *mem = (char *)vm::mapFile(file, capacity, (void *)base);
+    if(!mem) {
+        LOG_WARN("Failed to map file ", file, " at address ", base,
+                 ", not using it for manager: ", name);
+        return false;
+    }
+    persistent = (PersistentHeader *)mem;
+    if(!reopen) {
+        new(persistent) PersistentHeader{};
+        persistent->magic       = PERSISTENT_MAGIC;
+        persistent->version     = PERSISTENT_VERSION;
+        persistent->headerBytes = sizeof(PersistentHeader);
+        persistent->base        = base;
+        persistent->capacity    = capacity;
+        persistent->used        = PERSISTENT_HEADER_BYTES;
+        persistent->dirty       = 1;
+    }
+    addOsBytes(persistent->used);
+    return reopen;
+}
+
+void MemoryManager::adoptPersistent()
+{
+    PersistentHeader *hdr = persistent;
+    MemArena *arena       = arenas.front();
+    for(PersistentPool *p = hdr->firstPool; p; p = p->next) {
+        p->pool.arena = arena;
+        arena->pools.push_back(&p->pool);
+    }
+    if(hdr->dirty) {
+        LOG_WARN("Persistent heap of manager: ", name,
+                 " was not saved on exit, the free memory in it will not be reused");
+        return;
+    }
+    hdr->dirty        = 1;
+    arena->freechunks = hdr->freechunks;
+    largeCache        = hdr->largeCache;
+    largeCacheBytes   = hdr->largeCacheBytes;
+    MemCounters &c    = arena->counters;
+    MemStats &saved   = hdr->counters;
+    c.allocCount.store(saved.allocCount, std::memory_order_relaxed);
+    c.freeCount.store(saved.freeCount, std::memory_order_relaxed);
+    c.reuseCount.store(saved.reuseCount, std::memory_order_relaxed);
+    c.requestedBytes.store(saved.requestedBytes, std::memory_order_relaxed);
+    c.allocBytes.store(saved.allocBytes, std::memory_order_relaxed);
+    c.freedBytes.store(saved.freedBytes, std::memory_order_relaxed);
+    for(size_t i = 0; i < SIZE_CLASS_COUNT; ++i) {
+        c.classAllocs[i].store(saved.sizeClasses[i].allocCount, std::memory_order_relaxed);
+        c.classFrees[i].store(saved.sizeClasses[i].freeCount, std::memory_order_relaxed);
+        c.classFreeChunks[i].store(saved.sizeClasses[i].freeChunks, std::memory_order_relaxed);
+    }
+}
+
+void MemoryManager::closePersistent()
+{
+    PersistentHeader *hdr = persistent;
+    hdr->freechunks       = {};
+    for(auto &a : arenas) {
+        collectRemoteFree(*a);
+        // The next manager starts with a new pool, so the rest of the current one is kept as free
+        // chunks.
+        MemPool *pool = a->current.load(std::memory_order_relaxed);
+        if(pool) retirePool(pool);
+        for(size_t i = 0; i < ALIGN_CLASS_COUNT; ++i) {
+            for(size_t j = 0; j < SIZE_CLASS_COUNT; ++j) {
+                size_t list = a->freechunks[i][j];
+                if(list == 0) continue;
+                size_t tail = list;
+                while(size_t next = getAllocDetail(tail, AllocDetails::NEXT)) tail = next;
+                setAllocDetail(tail, AllocDetails::NEXT, hdr->freechunks[i][j]);
+                hdr->freechunks[i][j] = list;
+            }
+        }
+    }
+    hdr->largeCache      = largeCache;
+    hdr->largeCacheBytes = largeCacheBytes;
+    hdr->counters        = stats();
+    hdr->dirty           = 0;
+    if(!vm::syncFile(hdr, hdr->capacity)) {
+        LOG_WARN("Failed to write the persistent heap of manager: ", name, " to its file");
+    }
+    vm::unmapFile(hdr, hdr->capacity);
+}
+
+char *MemoryManager::carvePersistent(size_t bytes, size_t align)
+{
+    size_t carved = 0;
+    char *res     = nullptr;
+    {
+        LockGuard<Mutex> lock(persistentMtx);
+        size_t used  = persistent->used;
+        size_t start = (used + align - 1) & ~(align - 1);
+        if(start > persistent->capacity || persistent->capacity - start < bytes) return nullptr;
+        persistent->used = start + bytes;
+        carved           = persistent->used - used;
+        res              = (char *)persistent + start;
+    }
+    addOsBytes(carved);
+    return res;
+}
+
+bool MemoryManager::setRoot(StringRef name, void *alloc)
+{
+    if(!persistent || name.empty() || name.size() > MAX_ROOT_NAME_CHARS) return false;
+    LockGuard<Mutex> lock(persistentMtx);
+    PersistentRoot *unused = nullptr;
+    for(auto &root : persistent->roots) {
+        if(root.name == name) {
+            if(!alloc) root.name[0] = '\0';
+            root.alloc = (size_t)alloc;
+            return true;
+        }
+        if(!unused && root.name[0] == '\0') unused = &root;
+    }
+    if(!alloc) return true;
+    if(!unused) return false;
+    memcpy(unused->name, name.data(), name.size());
+    unused->name[name.size()] = '\0';
+    unused->alloc             = (size_t)alloc;
+    return true;
+}
+
+void *MemoryManager::getRoot(StringRef name)
+{
+    if(!persistent || name.empty()) return nullptr;
+    LockGuard<Mutex> lock(persistentMtx);
+    for(auto &root : persistent->roots) {
+        if(root.name == name) return (void *)root.alloc;
+    }
+    return nullptr;
+}
+
+bool MemoryManager::sync() { return persistent && vm::syncFile(persistent, persistent->capacity); }
+
 IAllocated::IAllocated() {}
 IAllocated::~IAllocated() {}
 
-IAllocatedList::IAllocatedList(MemoryManager &mem, String &&name)
-    : mem(mem), name(std::move(name)), count(0)
+ListIndex::ListIndex(MemoryManager &mem) : slots(mem), tree(mem), slotOf(0, mem), used(0) {}
+
+void ListIndex::update(size_t slot, ssize_t delta)
+{
+    for(size_t i = slot + 1; i <= tree.size(); i += i & (0 - i)) tree[i - 1] += delta;
+}
+
+void ListIndex::compact()
+{
+    std::erase(slots, nullptr);
+    tree.assign(slots.size(), 0);
+    for(size_t i = 0; i < slots.size(); ++i) {
+        slotOf[slots[i]] = i;
+        // Build the tree in O(n) by pushing each count up to its parent.
+        size_t pos = i + 1;
+        tree[i] += 1;
+        size_t parent = pos + (pos & (0 - pos));
+        if(parent <= tree.size()) tree[parent - 1] += tree[i];
+    }
+}
+
+void ListIndex::add(void *alloc)
+{
+    size_t pos = slots.size() + 1;
+    // The new node covers (pos - lowest bit of pos, pos], so it sums up the nodes covering the
+    // rest of that range.
+    size_t count = 1;
+    for(size_t i = pos - 1; i > pos - (pos & (0 - pos)); i -= i & (0 - i)) count += tree[i - 1];
+    slotOf[alloc] = slots.size();
+    slots.push_back(alloc);
+    tree.push_back(count);
+    ++used;
+}
+
+void ListIndex::remove(void *alloc)
+{
+    auto it = slotOf.find(alloc);
+    if(it == slotOf.end()) return;
+    slots[it->second] = nullptr;
+    update(it->second, -1);
+    slotOf.erase(it);
+    --used;
+    if(used < slots.size() / 2) compact();
+}
+
+void ListIndex::clear()
+{
+    slots.clear();
+    tree.clear();
+    slotOf.clear();
+    used = 0;
+}
+
+void *ListIndex::at(size_t index) const
+{
+    if(index >= used) return nullptr;
+    // Descend the tree to the slot with index used slots before it.
+    size_t pos = 0;
+    for(size_t step = std::bit_floor(tree.size()); step; step >>= 1) {
+        if(pos + step <= tree.size() && tree[pos + step - 1] <= index) {
+            pos += step;
+            index -= tree[pos - 1];
+        }
+    }
+    return slots[pos];
+}
+
+static ListIndex *newListIndex(MemoryManager &mem)
+{
+    return new(ManagedAllocator<ListIndex>(mem).allocate(1)) ListIndex(mem);
+}
+
+IAllocatedList::IAllocatedList(MemoryManager &mem, String &&name, bool indexed)
+    : name(std::move(name)), count(0), index(indexed ? newListIndex(mem) : nullptr), mem(mem)
 {}
-IAllocatedList::IAllocatedList(MemoryManager &mem, const char *name)
-    : mem(mem), name(name), count(0)
+IAllocatedList::IAllocatedList(MemoryManager &mem, const char *name, bool indexed)
+    : name(name), count(0), index(indexed ? newListIndex(mem) : nullptr), mem(mem)
 {}
-IAllocatedList::~IAllocatedList() {}
+IAllocatedList::~IAllocatedList()
+{
+    if(!index) return;
+    index->~ListIndex();
+    ManagedAllocator<ListIndex>(mem).deallocate(index, 1);
+}
 
 void *IAllocatedList::addAlloc(void *newAlloc, void *&start, void *&end)
 {
-    mem.setAllocDetail((size_t)newAlloc, AllocDetails::NEXT, 0);
-    mem.setAllocDetail((size_t)newAlloc, AllocDetails::PREV, (size_t)end);
+    nextOf(newAlloc) = nullptr;
+    prevOf(newAlloc) = end;
     if(!start) {
         start = newAlloc;
         end   = start;
     } else {
-        mem.setAllocDetail((size_t)end, AllocDetails::NEXT, (size_t)newAlloc);
-        end = newAlloc;
+        nextOf(end) = newAlloc;
+        end         = newAlloc;
     }
+    if(index) index->add(newAlloc);
     ++count;
     return newAlloc;
 }
@@ -180,47 +1675,83 @@ void *IAllocatedList::addAlloc(void *newAlloc, void *&start, void *&end)
 void *IAllocatedList::removeAlloc(void *alloc, void *&start, void *&end)
 {
     if(!alloc) return nullptr;
-    if(alloc == start) {
-        start = (void *)mem.getAllocDetail((size_t)alloc, AllocDetails::NEXT);
-        mem.setAllocDetail((size_t)alloc, AllocDetails::NEXT, 0);
-        if(start) mem.setAllocDetail((size_t)start, AllocDetails::PREV, 0);
-    } else if(alloc == end) {
-        end = (void *)mem.getAllocDetail((size_t)alloc, AllocDetails::PREV);
-        mem.setAllocDetail((size_t)alloc, AllocDetails::PREV, 0);
-        if(end) mem.setAllocDetail((size_t)end, AllocDetails::NEXT, 0);
-    } else {
-        void *prev = (void *)mem.getAllocDetail((size_t)alloc, AllocDetails::PREV);
-        void *next = (void *)mem.getAllocDetail((size_t)alloc, AllocDetails::NEXT);
-        mem.setAllocDetail((size_t)alloc, AllocDetails::PREV, 0);
-        mem.setAllocDetail((size_t)alloc, AllocDetails::NEXT, 0);
-        if(prev) mem.setAllocDetail((size_t)prev, AllocDetails::NEXT, (size_t)next);
-        if(next) mem.setAllocDetail((size_t)next, AllocDetails::PREV, (size_t)prev);
-    }
+    void *prev = prevOf(alloc);
+    void *next = nextOf(alloc);
+    if(prev) nextOf(prev) = next;
+    else start = next;
+    if(next) prevOf(next) = prev;
+    else end = prev;
+    prevOf(alloc) = nullptr;
+    nextOf(alloc) = nullptr;
+    if(index) index->remove(alloc);
     --count;
     return alloc;
 }
 
 void *IAllocatedList::removeAlloc(size_t allocIndex, void *&start, void *&end)
 {
-    void *iter = nullptr;
-    size_t i   = 0;
-    while(i++ <= allocIndex && (iter = getNext(iter, start)));
-    return removeAlloc(iter, start, end);
+    return removeAlloc(getAt(allocIndex, start, end), start, end);
 }
 
 void *IAllocatedList::getAt(size_t index, void *start, void *end) const
 {
+    if(this->index) return this->index->at(index);
     size_t i   = 0;
     void *iter = nullptr;
     while(i <= index && (iter = getNext(iter, start))) { ++i; }
     return iter;
 }
 
-ManagedList::ManagedList(MemoryManager &mem, String &&name)
-    : IAllocatedList(mem, std::move(name)), start(0), end(0)
+size_t IAllocatedList::freeAll(void *&start, void *&end, bool destroy)
+{
+    Array<void *, 256> batch;
+    size_t total = 0;
+    while(start) {
+        size_t n = 0;
+        for(; n < batch.size() && start; ++n) {
+            batch[n] = start;
+            start    = nextOf(start);
+            // The links must be reset before freeing (see AllocDetails).
+            nextOf(batch[n]) = nullptr;
+            prevOf(batch[n]) = nullptr;
+            if(destroy) ((IAllocated *)batch[n])->~IAllocated();
+        }
+        mem.freeListBatch(Span<void *>(batch.data(), n));
+        total += n;
+    }
+    end   = nullptr;
+    count = 0;
+    if(index) index->clear();
+    return total;
+}
+
+size_t IAllocatedList::adoptAll(void *first, void *&start, void *&end)
+{
+    assert(!start && "list must be empty to adopt allocations");
+    start = first;
+    for(void *alloc = first; alloc; alloc = nextOf(alloc)) {
+        end = alloc;
+        if(index) index->add(alloc);
+        ++count;
+    }
+    return count;
+}
+
+void *IAllocatedList::releaseAll(void *&start, void *&end)
+{
+    void *first = start;
+    start       = nullptr;
+    end         = nullptr;
+    count       = 0;
+    if(index) index->clear();
+    return first;
+}
+
+ManagedList::ManagedList(MemoryManager &mem, String &&name, bool indexed)
+    : IAllocatedList(mem, std::move(name), indexed), start(0), end(0)
 {}
-ManagedList::ManagedList(MemoryManager &mem, const char *name)
-    : IAllocatedList(mem, name), start(0), end(0)
+ManagedList::ManagedList(MemoryManager &mem, const char *name, bool indexed)
+    : IAllocatedList(mem, name, indexed), start(0), end(0)
 {}
 ManagedList::~ManagedList()
 {
@@ -231,33 +1762,24 @@ ManagedList::~ManagedList()
 bool ManagedList::free(IAllocated *alloc)
 {
     removeAlloc(alloc, (void *&)start, (void *&)end);
-    mem.freeDeinit(alloc);
+    mem.freeListDeinit(alloc);
     return true;
 }
 bool ManagedList::free(size_t index)
 {
     IAllocated *alloc = (IAllocated *)removeAlloc(index, (void *&)start, (void *&)end);
     if(!alloc) return false;
-    mem.freeDeinit(alloc);
+    mem.freeListDeinit(alloc);
     return true;
 }
 
-size_t ManagedList::clear()
-{
-    size_t count = 0;
-    while(start) {
-        free(start);
-        ++count;
-    }
-    end = start;
-    return count;
-}
+size_t ManagedList::clear() { return freeAll((void *&)start, (void *&)end, true); }
 
-ManagedRawList::ManagedRawList(MemoryManager &mem, String &&name)
-    : IAllocatedList(mem, std::move(name)), start(0), end(0)
+ManagedRawList::ManagedRawList(MemoryManager &mem, String &&name, bool indexed)
+    : IAllocatedList(mem, std::move(name), indexed), start(0), end(0)
 {}
-ManagedRawList::ManagedRawList(MemoryManager &mem, const char *name)
-    : IAllocatedList(mem, name), start(0), end(0)
+ManagedRawList::ManagedRawList(MemoryManager &mem, const char *name, bool indexed)
+    : IAllocatedList(mem, name, indexed), start(0), end(0)
 {}
 ManagedRawList::~ManagedRawList()
 {
@@ -268,26 +1790,17 @@ ManagedRawList::~ManagedRawList()
 bool ManagedRawList::free(void *alloc)
 {
     removeAlloc(alloc, start, end);
-    mem.freeRaw(alloc);
+    mem.freeListRaw(alloc);
     return true;
 }
 bool ManagedRawList::free(size_t index)
 {
     void *alloc = removeAlloc(index, start, end);
     if(!alloc) return false;
-    mem.freeRaw(alloc);
+    mem.freeListRaw(alloc);
     return true;
 }
 
-size_t ManagedRawList::clear()
-{
-    size_t count = 0;
-    while(start) {
-        free(start);
-        ++count;
-    }
-    end = start;
-    return count;
-}
+size_t ManagedRawList::clear() { return freeAll(start, end, false); }
 
 } // namespace core
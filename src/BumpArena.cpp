@@ -0,0 +1,73 @@
+#include "BumpArena.hpp"
+
+namespace core
+{
+
+BumpArena::Scope::Scope(BumpArena &arena) : arena(arena), marker(arena.mark()) {}
+BumpArena::Scope::~Scope() { arena.rewind(marker); }
+
+BumpArena::BumpArena(MemoryManager &mem, size_t blockSize)
+    : mem(mem), first(nullptr), block(nullptr), head(nullptr), end(nullptr), dtors(nullptr),
+      blockSize(blockSize)
+{}
+BumpArena::~BumpArena()
+{
+    runDtors(nullptr);
+    while(first) {
+        Block *next = first->next;
+        mem.freeRaw(first);
+        first = next;
+    }
+}
+
+void *BumpArena::allocSlow(size_t size, size_t align)
+{
+    if(size > MAX_LARGE_CLASS_SIZE) return nullptr;
+    // Room for aligning the allocation within the block.
+    size_t required = BLOCK_HEADER_BYTES + size + (align > MAX_ALIGNMENT ? align : 0);
+    Block *next     = block ? block->next : first;
+    if(!next || (size_t)(next->end - (char *)next) < required) {
+        // Blocks too small for the allocation stay after the new one for later use.
+        size_t allocSz = std::max(blockSize, required);
+        Block *newBlock = (Block *)mem.allocRaw(allocSz, MAX_ALIGNMENT);
+        if(!newBlock) return nullptr;
+        newBlock->next  = next;
+        newBlock->end   = (char *)newBlock + allocSz;
+        if(block) block->next = newBlock;
+        else first = newBlock;
+        next = newBlock;
+    }
+    block = next;
+    head  = (char *)block + BLOCK_HEADER_BYTES;
+    end   = block->end;
+    return allocRaw(size, align);
+}
+
+void BumpArena::runDtors(Dtor *until)
+{
+    while(dtors != until) {
+        Dtor *dtor = dtors;
+        // The destructor may allocate from the arena, so unlink the entry first.
+        dtors = dtor->prev;
+        dtor->fn(dtor->obj);
+    }
+}
+
+void BumpArena::rewind(const Marker &marker)
+{
+    runDtors(marker.dtors);
+    block = marker.block;
+    head  = marker.head;
+    end   = block ? block->end : nullptr;
+}
+
+void BumpArena::reset() { rewind({nullptr, nullptr, nullptr}); }
+
+size_t BumpArena::getReservedBytes() const
+{
+    size_t bytes = 0;
+    for(Block *b = first; b; b = b->next) bytes += b->end - (char *)b;
+    return bytes;
+}
+
+} // namespace core
@@ -0,0 +1,217 @@
+#include "HeapProfiler.hpp"
+
+#include <cmath>
+
+#if defined(CORE_OS_WINDOWS)
+#include <Windows.h>
+#elif defined(CORE_OS_LINUX) || defined(CORE_OS_APPLE) || defined(CORE_OS_BSD)
+#include <cxxabi.h>
+#include <execinfo.h>
+#define CORE_HAS_EXECINFO
+#endif
+
+namespace core
+{
+
+// Frames of the profiler itself (onAlloc() and record()) at the top of the captured stacks.
+// Inlining may make it skip a frame of the allocator instead, which doesn't matter.
+static constexpr size_t PROFILER_FRAMES = 2;
+
+static size_t captureStack(void **frames, size_t maxFrames)
+{
+#if defined(CORE_OS_WINDOWS)
+    return CaptureStackBackTrace(PROFILER_FRAMES, maxFrames, frames, nullptr);
+#elif defined(CORE_HAS_EXECINFO)
+    void *buf[MAX_PROFILE_FRAMES + PROFILER_FRAMES];
+    int count = backtrace(buf, maxFrames + PROFILER_FRAMES);
+    if(count <= (int)PROFILER_FRAMES) return 0;
+    memcpy(frames, buf + PROFILER_FRAMES, (count - PROFILER_FRAMES) * sizeof(void *));
+    return count - PROFILER_FRAMES;
+#else
+    return 0;
+#endif
+}
+
+// Name of the function containing the frame, or its address if that isn't known.
+static String symbolize(void *frame)
+{
+#if defined(CORE_HAS_EXECINFO)
+    char **syms = backtrace_symbols(&frame, 1);
+    String res;
+    if(syms) {
+        // glibc gives "binary(mangled+offset) [address]".
+        StringRef sym = syms[0];
+        size_t begin  = sym.find('(');
+        size_t end    = sym.find_first_of("+)", begin);
+        if(begin != StringRef::npos && end != StringRef::npos && end > begin + 1) {
+            String mangled(sym.substr(begin + 1, end - begin - 1));
+            int status      = 0;
+            char *demangled = abi::__cxa_demangle(mangled.c_str(), nullptr, nullptr, &status);
+            res             = status == 0 ? demangled : mangled;
+            std::free(demangled);
+        }
+        std::free(syms);
+    }
+    if(!res.empty()) return res;
+#endif
+    char buf[2 + 2 * sizeof(void *) + 1];
+    snprintf(buf, sizeof(buf), "%p", frame);
+    return buf;
+}
+
+HeapProfiler::HeapProfiler(size_t interval) : interval(interval), filter({}) {}
+
+size_t HeapProfiler::nextSampleDistance(size_t interval)
+{
+    // xorshift64*, seeded differently for each thread.
+    static thread_local uint64_t state = ((uint64_t)(size_t)&state * 0x9E3779B97F4A7C15ull) | 1;
+    state ^= state >> 12;
+    state ^= state << 25;
+    state ^= state >> 27;
+    double u    = ((state * 0x2545F4914F6CDD1Dull) >> 11) * 0x1.0p-53; // [0, 1)
+    double dist = -std::log(1.0 - u) * interval;
+    return std::max((size_t)std::min(dist, 1e18), size_t(1));
+}
+
+void HeapProfiler::onAlloc(size_t &countdown, Span<void *> allocs, size_t size)
+{
+    size_t interval = getInterval();
+    if(interval == 0) return;
+    if(countdown == 0) countdown = nextSampleDistance(interval);
+    if(countdown > size * allocs.size()) {
+        countdown -= size * allocs.size();
+        return;
+    }
+    for(void *alloc : allocs) {
+        if(countdown > size) {
+            countdown -= size;
+            continue;
+        }
+        record(alloc, size, interval);
+        countdown = nextSampleDistance(interval);
+    }
+}
+
+void HeapProfiler::record(void *alloc, size_t size, size_t interval)
+{
+    Array<void *, MAX_PROFILE_FRAMES> frames;
+    size_t frameCount = captureStack(frames.data(), frames.size());
+    // FNV-1a over the frame addresses.
+    size_t hash = 14695981039346656037ull;
+    for(size_t i = 0; i < frameCount; ++i) hash = (hash ^ (size_t)frames[i]) * 1099511628211ull;
+    // An allocation is sampled with probability 1 - e^(-size / interval), so each sample stands
+    // for the inverse of that many allocations of its size.
+    double estimate = size / (1.0 - std::exp(-(double)size / interval));
+
+    LockGuard<Mutex> lock(mtx);
+    auto [site, inserted] = sites.try_emplace(hash);
+    if(inserted) {
+        site->second            = {};
+        site->second.frames     = frames;
+        site->second.frameCount = frameCount;
+    }
+    ++site->second.liveCount;
+    ++site->second.allocCount;
+    site->second.liveBytes += size;
+    site->second.allocBytes += size;
+    site->second.liveEstimate += estimate;
+    // Allocations are always reported as freed, but stay on the safe side.
+    auto old = samples.find(alloc);
+    if(old != samples.end()) drop(old);
+    samples[alloc] = {hash, size, estimate};
+    filter[filterSlot(alloc)].fetch_add(1, std::memory_order_relaxed);
+}
+
+void HeapProfiler::release(void *alloc)
+{
+    LockGuard<Mutex> lock(mtx);
+    auto it = samples.find(alloc);
+    if(it != samples.end()) drop(it);
+}
+
+void HeapProfiler::resize(void *alloc, void *newAlloc, size_t newSize)
+{
+    LockGuard<Mutex> lock(mtx);
+    auto it = samples.find(alloc);
+    if(it == samples.end()) return;
+    Sample sample  = it->second;
+    CallSite &site = sites[sample.site];
+    // The sample still stands for as many allocations, now of the new size.
+    double estimate = sample.estimate * newSize / sample.size;
+    site.liveBytes += newSize - sample.size;
+    site.liveEstimate += estimate - sample.estimate;
+    sample.size     = newSize;
+    sample.estimate = estimate;
+    if(newAlloc == alloc) {
+        it->second = sample;
+        return;
+    }
+    filter[filterSlot(alloc)].fetch_sub(1, std::memory_order_relaxed);
+    samples.erase(it);
+    auto old = samples.find(newAlloc);
+    if(old != samples.end()) drop(old);
+    samples[newAlloc] = sample;
+    filter[filterSlot(newAlloc)].fetch_add(1, std::memory_order_relaxed);
+}
+
+void HeapProfiler::drop(Map<void *, Sample>::iterator it)
+{
+    CallSite &site = sites[it->second.site];
+    --site.liveCount;
+    site.liveBytes -= it->second.size;
+    site.liveEstimate -= it->second.estimate;
+    filter[filterSlot(it->first)].fetch_sub(1, std::memory_order_relaxed);
+    samples.erase(it);
+}
+
+size_t HeapProfiler::getSampleCount()
+{
+    LockGuard<Mutex> lock(mtx);
+    return samples.size();
+}
+
+size_t HeapProfiler::getLiveEstimate()
+{
+    LockGuard<Mutex> lock(mtx);
+    double total = 0;
+    for(auto &s : samples) total += s.second.estimate;
+    return total;
+}
+
+bool HeapProfiler::write(OStream &os, ProfileFormat format)
+{
+    LockGuard<Mutex> lock(mtx);
+    if(format == ProfileFormat::FOLDED) {
+        for(auto &[hash, site] : sites) {
+            if(site.liveCount == 0) continue;
+            for(size_t i = site.frameCount; i-- > 0;) {
+                os << symbolize(site.frames[i]) << (i > 0 ? ";" : "");
+            }
+            os << " " << (size_t)std::llround(site.liveEstimate) << "\n";
+        }
+        return (bool)os;
+    }
+
+    CallSite total = {};
+    for(auto &[hash, site] : sites) {
+        total.liveCount += site.liveCount;
+        total.liveBytes += site.liveBytes;
+        total.allocCount += site.allocCount;
+        total.allocBytes += site.allocBytes;
+    }
+    os << "heap profile: " << total.liveCount << ": " << total.liveBytes << " ["
+       << total.allocCount << ": " << total.allocBytes << "] @ heap_v2/" << getInterval() << "\n";
+    for(auto &[hash, site] : sites) {
+        os << site.liveCount << ": " << site.liveBytes << " [" << site.allocCount << ": "
+           << site.allocBytes << "] @" << std::hex;
+        for(size_t i = 0; i < site.frameCount; ++i) os << " 0x" << (size_t)site.frames[i];
+        os << std::dec << "\n";
+    }
+    // pprof needs these to map the addresses back to the binaries.
+    os << "\nMAPPED_LIBRARIES:\n";
+    IFStream maps("/proc/self/maps");
+    if(maps) os << maps.rdbuf();
+    return (bool)os;
+}
+
+} // namespace core
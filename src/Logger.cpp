@@ -1,5 +1,6 @@
 #include "Logger.hpp"
 
+#include <bit>
 #include <chrono>
 
 namespace core
@@ -7,6 +8,77 @@ namespace core
 
 Logger logger;
 
+static Atomic<size_t> nextLoggerId = 1;
+
+// IDs of the loggers which are alive, the sites which have been reached, the rules for their modes,
+// and the sites which have been given a binary log ID (at index ID - 1).
+// Intentionally leaked so that they outlive all static and thread_local destructors.
+static Mutex &logRegistryMtx()
+{
+    static Mutex *mtx = new Mutex;
+    return *mtx;
+}
+static Set<size_t> &liveLoggers()
+{
+    static Set<size_t> *ids = new Set<size_t>;
+    return *ids;
+}
+static Vector<LogSite *> &logSites()
+{
+    static Vector<LogSite *> *sites = new Vector<LogSite *>;
+    return *sites;
+}
+struct LogSiteRule
+{
+    String file;
+    String func;
+    LogSiteMode mode;
+};
+static Vector<LogSiteRule> &logSiteRules()
+{
+    static Vector<LogSiteRule> *rules = new Vector<LogSiteRule>;
+    return *rules;
+}
+static Vector<LogSite *> &binaryLogSites()
+{
+    static Vector<LogSite *> *sites = new Vector<LogSite *>;
+    return *sites;
+}
+static Vector<LogCategory *> &logCategories()
+{
+    static Vector<LogCategory *> *categories = new Vector<LogCategory *>;
+    return *categories;
+}
+
+struct ThreadLogBuffer
+{
+    size_t loggerId;
+    BinaryLogBuffer *buf;
+};
+
+// Binary log buffers owned by the thread. Gives them up when the thread exits.
+struct ThreadLogBufferList
+{
+    Vector<ThreadLogBuffer> buffers;
+
+    ~ThreadLogBufferList();
+};
+
+static thread_local ThreadLogBuffer lastLogBuffer = {0, nullptr};
+static thread_local ThreadLogBufferList threadLogBuffers;
+static thread_local bool threadLogBuffersDestroyed = false;
+
+ThreadLogBufferList::~ThreadLogBufferList()
+{
+    LockGuard<Mutex> lock(logRegistryMtx());
+    for(auto &tb : buffers) {
+        if(!liveLoggers().contains(tb.loggerId)) continue;
+        tb.buf->owned.store(false, std::memory_order_release);
+    }
+    lastLogBuffer             = {0, nullptr};
+    threadLogBuffersDestroyed = true;
+}
+
 const char *logLevelStr(LogLevels::LogLevels lvl)
 {
     if(lvl == LogLevels::FATAL) return "FATAL";
@@ -41,27 +113,594 @@ SinkInfo::~SinkInfo()
     if(mustClose) delete f;
 }
 
-Logger::Logger() : level(LogLevels::WARN) {}
+String &logFormatBuffer()
+{
+    static thread_local String buf;
+    return buf;
+}
 
-void Logger::logInternal(LogLevels::LogLevels lvl, StringRef data)
+int64_t logTimeNow()
+{
+    namespace chrono = std::chrono;
+    return chrono::duration_cast<chrono::microseconds>(
+               chrono::system_clock::now().time_since_epoch())
+        .count();
+}
+
+void writeLogRecord(OStream &os, LogLevels::LogLevels lvl, int64_t time, StringRef data,
+                    bool withCol)
 {
-    namespace chrono           = std::chrono;
-    chrono::microseconds count = std::chrono::duration_cast<std::chrono::microseconds>(
-        chrono::system_clock::now().time_since_epoch());
-    std::time_t time =
-        std::chrono::system_clock::to_time_t(chrono::system_clock::time_point{count});
-    std::tm *t        = std::localtime(&time);
+    namespace chrono = std::chrono;
+    chrono::system_clock::time_point point{chrono::microseconds(time)};
+    std::time_t secs = chrono::system_clock::to_time_t(point);
+    std::tm t = {};
+#if defined(CORE_OS_WINDOWS)
+    localtime_s(&t, &secs);
+#else
+    localtime_r(&secs, &t);
+#endif
     char timeBuf[512] = {0};
-    std::strftime(timeBuf, sizeof(timeBuf), "%FT%T%z", t); // %Y-%m-%dT%H:%M:%S+0000
-    for(auto &s : sinks) {
-        if(s.withCol) {
-            (*s.f) << "[" << timeBuf << "][" << logLevelColorStr(lvl) << logLevelStr(lvl)
-                   << "\033[0m]: ";
+    std::strftime(timeBuf, sizeof(timeBuf), "%FT%T%z", &t); // %Y-%m-%dT%H:%M:%S+0000
+    if(withCol) {
+        os << "[" << timeBuf << "][" << logLevelColorStr(lvl) << logLevelStr(lvl) << "\033[0m]: ";
+    } else {
+        os << "[" << timeBuf << "][" << logLevelStr(lvl) << "]: ";
+    }
+    os << data << '\n';
+}
+
+// '*' matches any run of characters, everything else itself.
+static bool matchLogPattern(StringRef pattern, StringRef str)
+{
+    size_t p = 0, s = 0;
+    // Position after the last '*', and the position in str it was matched up to.
+    size_t starP = StringRef::npos, starS = 0;
+    while(s < str.size()) {
+        if(p < pattern.size() && pattern[p] == '*') {
+            starP = ++p;
+            starS = s;
+        } else if(p < pattern.size() && pattern[p] == str[s]) {
+            ++p;
+            ++s;
+        } else if(starP != StringRef::npos) {
+            // Let the last '*' match one more character.
+            p = starP;
+            s = ++starS;
         } else {
-            (*s.f) << "[" << timeBuf << "][" << logLevelStr(lvl) << "]: ";
+            return false;
         }
-        (*s.f) << data << '\n';
     }
+    while(p < pattern.size() && pattern[p] == '*') ++p;
+    return p == pattern.size();
+}
+
+static bool matchLogSiteRule(const LogSiteRule &rule, const LogSite &site)
+{
+    if(!rule.file.empty()) {
+        StringRef file = site.file;
+        StringRef name = file.substr(file.find_last_of("/\\") + 1);
+        if(!matchLogPattern(rule.file, file) && !matchLogPattern(rule.file, name)) return false;
+    }
+    return rule.func.empty() || matchLogPattern(rule.func, site.function);
+}
+
+static bool isLogSiteEnabledAt(const LogSite &site, LogLevels::LogLevels lvl)
+{
+    LogSiteMode mode = site.mode.load(std::memory_order_relaxed);
+    return mode == LogSiteMode::ENABLED || (mode == LogSiteMode::DEFAULT && lvl >= site.lvl);
+}
+
+// State of the site when bound to level. logRegistryMtx() must be locked by the caller.
+static uintptr_t logSiteState(const LogSite &site, Atomic<LogLevels::LogLevels> &level)
+{
+    return (uintptr_t)&level | isLogSiteEnabledAt(site, level.load(std::memory_order_relaxed));
+}
+
+// Sets the level of a Logger or LogCategory, and updates the sites bound to it.
+// logRegistryMtx() must be locked by the caller.
+static void setLogLevel(Atomic<LogLevels::LogLevels> &level, LogLevels::LogLevels lvl)
+{
+    level.store(lvl, std::memory_order_relaxed);
+    for(auto &site : logSites()) {
+        uintptr_t state = site->state.load(std::memory_order_relaxed);
+        if((state & ~uintptr_t(1)) != (uintptr_t)&level) continue;
+        site->state.store(logSiteState(*site, level), std::memory_order_relaxed);
+    }
+}
+
+// Unbinds the sites bound to the level of a Logger or LogCategory which is being destroyed, so
+// that they are bound again the next time they are reached.
+// logRegistryMtx() must be locked by the caller.
+static void unbindLogSites(Atomic<LogLevels::LogLevels> &level)
+{
+    for(auto &site : logSites()) {
+        uintptr_t state = site->state.load(std::memory_order_relaxed);
+        if((state & ~uintptr_t(1)) == (uintptr_t)&level) {
+            site->state.store(0, std::memory_order_relaxed);
+        }
+    }
+}
+
+bool checkLogSite(LogSite &site, Atomic<LogLevels::LogLevels> &level)
+{
+    if(site.state.load(std::memory_order_relaxed) == 0) {
+        LockGuard<Mutex> lock(logRegistryMtx());
+        if(site.mode.load(std::memory_order_relaxed) == LogSiteMode::UNREGISTERED) {
+            LogSiteMode mode = LogSiteMode::DEFAULT;
+            for(auto &rule : logSiteRules()) {
+                if(matchLogSiteRule(rule, site)) mode = rule.mode;
+            }
+            logSites().push_back(&site);
+            site.mode.store(mode, std::memory_order_relaxed);
+        }
+        uintptr_t state = site.state.load(std::memory_order_relaxed);
+        if(state == 0) {
+            state = logSiteState(site, level);
+            site.state.store(state, std::memory_order_relaxed);
+        }
+        if((state & ~uintptr_t(1)) == (uintptr_t)&level) return state & 1;
+    }
+    // Bound to the level of another logger or category.
+    return isLogSiteEnabledAt(site, level.load(std::memory_order_relaxed));
+}
+
+size_t setLogSiteMode(StringRef filePattern, StringRef funcPattern, LogSiteMode mode)
+{
+    if(mode == LogSiteMode::UNREGISTERED) return 0;
+    LockGuard<Mutex> lock(logRegistryMtx());
+    auto &rules = logSiteRules();
+    if(filePattern.empty() && funcPattern.empty()) rules.clear();
+    std::erase_if(rules, [&](const LogSiteRule &rule) {
+        return rule.file == filePattern && rule.func == funcPattern;
+    });
+    LogSiteRule rule{String(filePattern), String(funcPattern), mode};
+    size_t count = 0;
+    for(auto &site : logSites()) {
+        if(!matchLogSiteRule(rule, *site)) continue;
+        site->mode.store(mode, std::memory_order_relaxed);
+        uintptr_t state = site->state.load(std::memory_order_relaxed);
+        if(state != 0) {
+            auto &level = *(Atomic<LogLevels::LogLevels> *)(state & ~uintptr_t(1));
+            site->state.store(logSiteState(*site, level), std::memory_order_relaxed);
+        }
+        ++count;
+    }
+    rules.push_back(std::move(rule));
+    return count;
+}
+
+Vector<const LogSite *> getLogSites()
+{
+    LockGuard<Mutex> lock(logRegistryMtx());
+    return Vector<const LogSite *>(logSites().begin(), logSites().end());
+}
+
+uint32_t registerBinaryLogSite(LogSite &site, Span<const LogArg> args)
+{
+    LockGuard<Mutex> lock(logRegistryMtx());
+    uint32_t id = site.id.load(std::memory_order_relaxed);
+    if(id != 0) return id;
+    site.args = args;
+    binaryLogSites().push_back(&site);
+    id = binaryLogSites().size();
+    site.id.store(id, std::memory_order_release);
+    return id;
+}
+
+BinaryLogBuffer::BinaryLogBuffer() : owned(false) { data.reserve(BINARY_LOG_CHUNK + 1024); }
+
+LogQueue::LogQueue(size_t capacity)
+    : slots(std::bit_ceil(std::max(capacity, size_t(2)))), mask(slots.size() - 1), tail(0), head(0)
+{
+    for(size_t i = 0; i < slots.size(); ++i) slots[i].seq.store(i, std::memory_order_relaxed);
+}
+
+bool LogQueue::push(LogLevels::LogLevels lvl, int64_t time, StringRef msg)
+{
+    size_t pos = tail.load(std::memory_order_relaxed);
+    Slot *slot = nullptr;
+    while(true) {
+        slot       = &slots[pos & mask];
+        size_t seq = slot->seq.load(std::memory_order_acquire);
+        if(seq == pos) {
+            if(tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+        } else if((ssize_t)(seq - pos) < 0) {
+            // The slot still holds the record from the previous lap.
+            return false;
+        } else {
+            pos = tail.load(std::memory_order_relaxed);
+        }
+    }
+    slot->rec.lvl  = lvl;
+    slot->rec.time = time;
+    slot->rec.msg.assign(msg);
+    slot->seq.store(pos + 1, std::memory_order_release);
+    return true;
+}
+
+bool LogQueue::pop(LogRecord &rec)
+{
+    Slot &slot = slots[head & mask];
+    if(slot.seq.load(std::memory_order_acquire) != head + 1) return false;
+    rec.lvl  = slot.rec.lvl;
+    rec.time = slot.rec.time;
+    std::swap(rec.msg, slot.rec.msg);
+    // Frees the slot for the producer of the next lap.
+    slot.seq.store(head + slots.size(), std::memory_order_release);
+    ++head;
+    return true;
+}
+
+bool LogQueue::empty()
+{
+    return slots[head & mask].seq.load(std::memory_order_acquire) != head + 1;
+}
+
+Logger::Logger()
+    : level(LogLevels::WARN), queue(nullptr), overflow(LogOverflow::BLOCK), dropped(0), written(0),
+      writerIdle(false), id(nextLoggerId++), binary(false), binarySites(0)
+{
+    LockGuard<Mutex> lock(logRegistryMtx());
+    liveLoggers().insert(id);
+}
+Logger::~Logger()
+{
+    {
+        LockGuard<Mutex> lock(logRegistryMtx());
+        liveLoggers().erase(id);
+        unbindLogSites(level);
+    }
+    flush();
+    for(auto &buf : binaryBuffers) delete buf;
+    if(!writer.joinable()) return;
+    writer.request_stop();
+    writerIdle.store(false, std::memory_order_relaxed);
+    writerIdle.notify_one();
+    writer.join();
+    delete queue.load();
+}
+
+void Logger::setLevel(LogLevels::LogLevels lvl)
+{
+    LockGuard<Mutex> lock(logRegistryMtx());
+    setLogLevel(level, lvl);
+}
+
+void Logger::logInternal(LogLevels::LogLevels lvl, StringRef data)
+{
+    LogQueue *q = queue.load(std::memory_order_acquire);
+    if(!q) {
+        LockGuard<Mutex> lock(sinkMtx);
+        writeRecord(lvl, logTimeNow(), data);
+        return;
+    }
+    int64_t time = logTimeNow();
+    while(!q->push(lvl, time, data)) {
+        if(overflow == LogOverflow::DROP_AND_COUNT) dropped.fetch_add(1, std::memory_order_relaxed);
+        if(overflow != LogOverflow::BLOCK) return;
+        // Read before trying again, so that if the queue is still full, the writer advances it
+        // after the records it dequeues to make room - and the wait below cannot miss that.
+        size_t done = written.load(std::memory_order_acquire);
+        if(q->push(lvl, time, data)) break;
+        wakeWriter();
+        written.wait(done, std::memory_order_acquire);
+    }
+    wakeWriter();
+    if(lvl == LogLevels::FATAL) flush();
+}
+
+void Logger::writeRecord(LogLevels::LogLevels lvl, int64_t time, StringRef data)
+{
+    for(auto &s : sinks) writeLogRecord(*s.f, lvl, time, data, s.withCol);
+}
+
+void Logger::wakeWriter()
+{
+    // Pairs with the fence in writerLoop(): either the writer sees the new record before it goes
+    // idle, or this sees it idle.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if(!writerIdle.load(std::memory_order_relaxed)) return;
+    if(writerIdle.exchange(false, std::memory_order_relaxed)) writerIdle.notify_one();
+}
+
+void Logger::writerLoop(std::stop_token stop)
+{
+    LogQueue *q     = queue.load(std::memory_order_acquire);
+    size_t reported = 0;
+    LogRecord rec;
+    while(true) {
+        size_t count = 0;
+        {
+            LockGuard<Mutex> lock(sinkMtx);
+            // Bounded, so that flush() isn't kept waiting by a steady stream of records.
+            while(count < q->getCapacity() && q->pop(rec)) {
+                writeRecord(rec.lvl, rec.time, rec.msg);
+                ++count;
+            }
+            size_t drops = dropped.load(std::memory_order_relaxed);
+            bool report  = drops != reported;
+            if(report) {
+                writeRecord(LogLevels::WARN, logTimeNow(),
+                            utils::toString("Dropped ", drops - reported,
+                                            " log records as the queue was full"));
+                reported = drops;
+            }
+            if(count > 0 || report) {
+                for(auto &s : sinks) s.f->flush();
+            }
+        }
+        if(count > 0) {
+            written.fetch_add(count, std::memory_order_release);
+            written.notify_all();
+            continue;
+        }
+        if(stop.stop_requested()) return;
+        writerIdle.store(true, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if(q->empty() && !stop.stop_requested()) writerIdle.wait(true, std::memory_order_relaxed);
+        writerIdle.store(false, std::memory_order_relaxed);
+    }
+}
+
+bool Logger::setAsync(size_t queueSize, LogOverflow overflow)
+{
+    LockGuard<Mutex> lock(sinkMtx);
+    if(queue.load(std::memory_order_relaxed)) return false;
+    this->overflow = overflow;
+    queue.store(new LogQueue(queueSize), std::memory_order_release);
+    writer = JThread([this](std::stop_token stop) { writerLoop(stop); });
+    return true;
+}
+
+void Logger::flush()
+{
+    if(binary.load(std::memory_order_relaxed)) {
+        LockGuard<Mutex> lock(binaryMtx);
+        for(auto &buf : binaryBuffers) {
+            LockGuard<Mutex> bufLock(buf->mtx);
+            writeBinaryChunk(buf->data);
+            buf->data.clear();
+        }
+        binaryOut.flush();
+    }
+    LogQueue *q = queue.load(std::memory_order_acquire);
+    if(!q) {
+        LockGuard<Mutex> lock(sinkMtx);
+        for(auto &s : sinks) s.f->flush();
+        return;
+    }
+    // Records pushed later on are not waited for.
+    size_t target = q->getPushCount();
+    size_t done   = written.load(std::memory_order_acquire);
+    while(done < target) {
+        wakeWriter();
+        written.wait(done, std::memory_order_acquire);
+        done = written.load(std::memory_order_acquire);
+    }
+}
+
+bool Logger::setBinary(const Path &file)
+{
+    LockGuard<Mutex> lock(binaryMtx);
+    if(binary.load(std::memory_order_relaxed)) return false;
+    binaryOut.open(file, std::ios::binary | std::ios::trunc);
+    if(!binaryOut) return false;
+    binaryOut.write("LCBL", 4);
+    binaryOut.write((const char *)&BINARY_LOG_VERSION, sizeof(BINARY_LOG_VERSION));
+    binary.store(true, std::memory_order_release);
+    return true;
+}
+
+BinaryLogBuffer *Logger::getBinaryBuffer()
+{
+    if(lastLogBuffer.loggerId == id) return lastLogBuffer.buf;
+    if(threadLogBuffersDestroyed) return nullptr;
+    for(auto &tb : threadLogBuffers.buffers) {
+        if(tb.loggerId != id) continue;
+        lastLogBuffer = tb;
+        return tb.buf;
+    }
+    // Buffers of exited threads are reused.
+    BinaryLogBuffer *buf = nullptr;
+    {
+        LockGuard<Mutex> lock(binaryMtx);
+        for(auto &b : binaryBuffers) {
+            bool expected = false;
+            if(b->owned.compare_exchange_strong(expected, true, std::memory_order_acquire)) {
+                buf = b;
+                break;
+            }
+        }
+        if(!buf) {
+            buf = new BinaryLogBuffer();
+            buf->owned.store(true, std::memory_order_relaxed);
+            binaryBuffers.push_back(buf);
+        }
+    }
+    {
+        // Forget the buffers of loggers which don't exist anymore.
+        LockGuard<Mutex> lock(logRegistryMtx());
+        std::erase_if(threadLogBuffers.buffers, [](const ThreadLogBuffer &tb) {
+            return !liveLoggers().contains(tb.loggerId);
+        });
+    }
+    threadLogBuffers.buffers.push_back({id, buf});
+    lastLogBuffer = {id, buf};
+    return buf;
+}
+
+void Logger::flushBinaryBuffer(BinaryLogBuffer &buf)
+{
+    LockGuard<Mutex> lock(binaryMtx);
+    LockGuard<Mutex> bufLock(buf.mtx);
+    writeBinaryChunk(buf.data);
+    buf.data.clear();
+}
+
+void Logger::writeBinaryChunk(Span<const char> chunk)
+{
+    if(chunk.empty()) return;
+    // The records may belong to sites which haven't been defined in the file yet.
+    Vector<char> defs;
+    {
+        LockGuard<Mutex> lock(logRegistryMtx());
+        for(; binarySites < binaryLogSites().size(); ++binarySites) {
+            LogSite *site   = binaryLogSites()[binarySites];
+            uint32_t marker = 0;
+            uint32_t siteId = binarySites + 1;
+            uint8_t lvl     = site->lvl;
+            uint8_t count   = site->args.size();
+            putLogBytes(defs, &marker, sizeof(marker));
+            putLogBytes(defs, &siteId, sizeof(siteId));
+            putLogBytes(defs, &site->line, sizeof(site->line));
+            putLogBytes(defs, &lvl, sizeof(lvl));
+            putLogBytes(defs, &count, sizeof(count));
+            putLogBytes(defs, site->args.data(), count);
+            putLogString(defs, site->file);
+            putLogString(defs, site->format ? site->format : "");
+        }
+    }
+    binaryOut.write(defs.data(), defs.size());
+    binaryOut.write(chunk.data(), chunk.size());
+}
+
+struct BinaryLogSiteDef
+{
+    uint32_t line;
+    LogLevels::LogLevels lvl;
+    String file;
+    String format;
+    Vector<LogArg> args;
+};
+struct BinaryLogEntry
+{
+    int64_t time;
+    LogLevels::LogLevels lvl;
+    String msg;
+};
+
+template<typename T> static bool readLogValue(IStream &in, T &value)
+{
+    return (bool)in.read((char *)&value, sizeof(value));
+}
+static bool readLogString(IStream &in, String &str)
+{
+    uint32_t len = 0;
+    if(!readLogValue(in, len)) return false;
+    str.resize(len);
+    return (bool)in.read(str.data(), len);
+}
+// Appends the argument the same way it would have been formatted in text mode.
+template<bool format, size_t idx = 0>
+static bool decodeLogArg(IStream &in, LogArg tag, String &msg)
+{
+    if constexpr(idx == std::tuple_size_v<LogArgTypes>) {
+        String str;
+        if(tag != LogArg::STRING || !readLogString(in, str)) return false;
+        msg += str;
+        return true;
+    } else {
+        if((size_t)tag != idx) return decodeLogArg<format, idx + 1>(in, tag, msg);
+        std::tuple_element_t<idx, LogArgTypes> value;
+        if(!readLogValue(in, value)) return false;
+        if constexpr(format) utils::formatValue(msg, value);
+        else utils::appendToString(msg, value);
+        return true;
+    }
+}
+static bool decodeLogRecord(IStream &in, const BinaryLogSiteDef &site, String &msg)
+{
+    if(site.format.empty()) {
+        for(auto &tag : site.args) {
+            if(!decodeLogArg<false>(in, tag, msg)) return false;
+        }
+        return true;
+    }
+    StringRef rest = site.format;
+    for(auto &tag : site.args) {
+        rest = utils::appendFormatLiteral(msg, rest);
+        if(!decodeLogArg<true>(in, tag, msg)) return false;
+    }
+    utils::appendFormatLiteral(msg, rest);
+    return true;
+}
+
+bool decodeBinaryLog(IStream &in, OStream &out, bool withCol)
+{
+    char magic[4]    = {};
+    uint32_t version = 0;
+    if(!in.read(magic, sizeof(magic)) || StringRef(magic, sizeof(magic)) != "LCBL") return false;
+    if(!readLogValue(in, version) || version != BINARY_LOG_VERSION) return false;
+
+    Map<uint32_t, BinaryLogSiteDef> sites;
+    Vector<BinaryLogEntry> entries;
+    bool valid = true;
+    uint32_t siteId;
+    while(valid && readLogValue(in, siteId)) {
+        if(siteId == 0) {
+            BinaryLogSiteDef def;
+            uint8_t lvl = 0, count = 0;
+            valid = readLogValue(in, siteId) && readLogValue(in, def.line) &&
+                    readLogValue(in, lvl) && readLogValue(in, count);
+            def.lvl = (LogLevels::LogLevels)lvl;
+            def.args.resize(count);
+            valid = valid && in.read((char *)def.args.data(), count) &&
+                    readLogString(in, def.file) && readLogString(in, def.format);
+            if(valid) sites[siteId] = std::move(def);
+            continue;
+        }
+        auto it = sites.find(siteId);
+        BinaryLogEntry entry;
+        valid = it != sites.end() && readLogValue(in, entry.time);
+        if(!valid) break;
+        entry.lvl = it->second.lvl;
+        valid     = decodeLogRecord(in, it->second, entry.msg);
+        if(valid) entries.push_back(std::move(entry));
+    }
+    // Each thread's records are in order, but the chunks of different threads are not.
+    auto byTime = [](const BinaryLogEntry &a, const BinaryLogEntry &b) { return a.time < b.time; };
+    std::stable_sort(entries.begin(), entries.end(), byTime);
+    for(auto &e : entries) writeLogRecord(out, e.lvl, e.time, e.msg, withCol);
+    return valid && in.eof();
+}
+
+LogCategory::LogCategory(const char *name, LogLevels::LogLevels lvl, Logger &log)
+    : name(name), log(log), level(lvl)
+{
+    LockGuard<Mutex> lock(logRegistryMtx());
+    logCategories().push_back(this);
+}
+LogCategory::~LogCategory()
+{
+    LockGuard<Mutex> lock(logRegistryMtx());
+    std::erase(logCategories(), this);
+    unbindLogSites(level);
+}
+
+void LogCategory::setLevel(LogLevels::LogLevels lvl)
+{
+    LockGuard<Mutex> lock(logRegistryMtx());
+    setLogLevel(level, lvl);
+}
+
+bool setLogCategoryLevel(StringRef name, LogLevels::LogLevels lvl)
+{
+    LockGuard<Mutex> lock(logRegistryMtx());
+    bool found = false;
+    for(auto &cat : logCategories()) {
+        if(cat->getName() != name) continue;
+        setLogLevel(cat->getLevelVar(), lvl);
+        found = true;
+    }
+    return found;
+}
+
+Vector<String> getLogCategories()
+{
+    LockGuard<Mutex> lock(logRegistryMtx());
+    Vector<String> names;
+    for(auto &cat : logCategories()) names.emplace_back(cat->getName());
+    return names;
 }
 
 bool Logger::addSinkByName(const char *name, bool withCol)
@@ -307,6 +307,27 @@ String viewBackSlash(StringRef data)
     return res;
 }
 
+// Only ever "called" at compile time, where it makes the format string check fail.
+void invalidFormatString(const char * /* reason */) {}
+
+StringRef appendFormatLiteral(String &dest, StringRef fmt)
+{
+    size_t i = 0;
+    while(i < fmt.size()) {
+        size_t next = fmt.find_first_of("{}", i);
+        if(next == StringRef::npos || next + 1 >= fmt.size()) break;
+        dest.append(fmt.data() + i, next - i + 1);
+        if(fmt[next] == '{' && fmt[next + 1] == '}') {
+            dest.pop_back();
+            return fmt.substr(next + 2);
+        }
+        // escaped brace - only one of the pair is kept
+        i = next + 2;
+    }
+    dest.append(fmt.data() + i, fmt.size() - i);
+    return {};
+}
+
 void output(OStream &os, File *src, size_t locStart, size_t locEnd, StringRef data)
 {
     if(src && locStart != -1) {
@@ -0,0 +1,167 @@
+#include "VirtualMem.hpp"
+
+#if defined(CORE_OS_WINDOWS)
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h> // for sysconf()
+#endif
+
+namespace core::vm
+{
+
+size_t pageSize()
+{
+    static size_t sz = 0;
+    if(sz != 0) return sz;
+#if defined(CORE_OS_WINDOWS)
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    sz = info.dwPageSize;
+#else
+    sz = sysconf(_SC_PAGESIZE);
+#endif
+    return sz;
+}
+
+void *reserve(size_t size)
+{
+#if defined(CORE_OS_WINDOWS)
+    return VirtualAlloc(nullptr, size, MEM_RESERVE, PAGE_NOACCESS);
+#else
+    void *addr = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    return addr == MAP_FAILED ? nullptr : addr;
+#endif
+}
+
+void *reserveAligned(size_t size, size_t align)
+{
+    if(align <= pageSize()) return reserve(size);
+#if defined(CORE_OS_WINDOWS)
+    // Only whole reservations can be released, so reserve a larger range to find an aligned
+    // address in it, and reserve just that part after releasing the range. Another thread may
+    // grab the address in the meantime, so retry.
+    for(int i = 0; i < 8; ++i) {
+        char *addr = (char *)reserve(size + align);
+        if(!addr) return nullptr;
+        char *aligned = (char *)(((size_t)addr + align - 1) & ~(align - 1));
+        VirtualFree(addr, 0, MEM_RELEASE);
+        addr = (char *)VirtualAlloc(aligned, size, MEM_RESERVE, PAGE_NOACCESS);
+        if(addr) return addr;
+    }
+    return nullptr;
+#else
+    // Reserve a larger range and give back the parts before and after the aligned address.
+    size        = (size + pageSize() - 1) & ~(pageSize() - 1);
+    char *addr = (char *)reserve(size + align);
+    if(!addr) return nullptr;
+    char *aligned = (char *)(((size_t)addr + align - 1) & ~(align - 1));
+    if(aligned != addr) munmap(addr, aligned - addr);
+    size_t tail = (addr + size + align) - (aligned + size);
+    if(tail > 0) munmap(aligned + size, tail);
+    return aligned;
+#endif
+}
+
+bool commit([[maybe_unused]] void *addr, [[maybe_unused]] size_t size)
+{
+#if defined(CORE_OS_WINDOWS)
+    return VirtualAlloc(addr, size, MEM_COMMIT, PAGE_READWRITE) != nullptr;
+#else
+    return true;
+#endif
+}
+
+bool purge(void *addr, size_t size)
+{
+#if defined(CORE_OS_WINDOWS)
+    return VirtualAlloc(addr, size, MEM_RESET, PAGE_READWRITE) != nullptr;
+#else
+    return madvise(addr, size, MADV_DONTNEED) == 0;
+#endif
+}
+
+bool adviseHugePages(void *addr, size_t size)
+{
+#if defined(MADV_HUGEPAGE)
+    return madvise(addr, size, MADV_HUGEPAGE) == 0;
+#else
+    return false;
+#endif
+}
+
+void *remap(void *addr, size_t oldSize, size_t newSize)
+{
+#if defined(CORE_OS_LINUX)
+    void *res = mremap(addr, oldSize, newSize, MREMAP_MAYMOVE);
+    return res == MAP_FAILED ? nullptr : res;
+#else
+    return nullptr;
+#endif
+}
+
+void release(void *addr, size_t size)
+{
+#if defined(CORE_OS_WINDOWS)
+    VirtualFree(addr, 0, MEM_RELEASE);
+#else
+    munmap(addr, size);
+#endif
+}
+
+void *mapFile(const Path &path, size_t size, void *base)
+{
+#if defined(CORE_OS_WINDOWS)
+    HANDLE file = CreateFileW(path.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, OPEN_ALWAYS,
+                              FILE_ATTRIBUTE_NORMAL, nullptr);
+    if(file == INVALID_HANDLE_VALUE) return nullptr;
+    // The mapping extends the file if it is smaller.
+    HANDLE mapping = CreateFileMappingW(file, nullptr, PAGE_READWRITE,
+                                        (DWORD)((uint64_t)size >> 32), (DWORD)size, nullptr);
+    CloseHandle(file);
+    if(!mapping) return nullptr;
+    void *addr = MapViewOfFileEx(mapping, FILE_MAP_ALL_ACCESS, 0, 0, size, base);
+    CloseHandle(mapping);
+    return addr;
+#else
+    int fd = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if(fd < 0) return nullptr;
+    struct stat st;
+    if(fstat(fd, &st) != 0 || ((size_t)st.st_size < size && ftruncate(fd, size) != 0)) {
+        close(fd);
+        return nullptr;
+    }
+    // Without MAP_FIXED, base is only a hint - which doesn't replace any existing mapping.
+    void *addr = mmap(base, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(addr == MAP_FAILED) return nullptr;
+    if(addr != base) {
+        munmap(addr, size);
+        return nullptr;
+    }
+    return addr;
+#endif
+}
+
+bool syncFile(void *addr, size_t size)
+{
+#if defined(CORE_OS_WINDOWS)
+    return FlushViewOfFile(addr, size);
+#else
+    return msync(addr, size, MS_SYNC) == 0;
+#endif
+}
+
+void unmapFile(void *addr, size_t size)
+{
+#if defined(CORE_OS_WINDOWS)
+    UnmapViewOfFile(addr);
+#else
+    munmap(addr, size);
+#endif
+}
+
+} // namespace core::vm
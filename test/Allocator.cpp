@@ -1,4 +1,5 @@
 #include "Allocator.hpp"
+#include "Logger.hpp"
 
 #include <catch2/catch_all.hpp>
 
@@ -26,6 +27,685 @@ TEST_CASE("MemoryManager.Basic")
     REQUIRE(mem.getPoolCount() == 1);
 }
 
+TEST_CASE("MemoryManager.SizeClasses")
+{
+    size_t badClasses = 0;
+    for(size_t sz = 1; sz <= MAX_ROUNDUP; ++sz) {
+        size_t idx = getSizeClass(sz);
+        // Must be the smallest class that fits, and waste at most 25% beyond SIZE_CLASS_STEP.
+        if(SIZE_CLASSES[idx] < sz || (idx > 0 && SIZE_CLASSES[idx - 1] >= sz)) ++badClasses;
+        if(sz > SIZE_CLASS_STEP && SIZE_CLASSES[idx] > sz + sz / 4) ++badClasses;
+        if(SIZE_CLASSES[idx] % MAX_ALIGNMENT != 0) ++badClasses;
+    }
+    REQUIRE(badClasses == 0);
+
+    MemoryManager mem("SizeClasses");
+    // A 33 byte allocation (+ AllocDetail) must not get rounded up to the next power of two.
+    void *alloc = mem.allocRaw(33, 1);
+    REQUIRE(mem.getAllocDetail((size_t)alloc, AllocDetails::SIZE) == 80);
+    mem.freeRaw(alloc);
+    // Allocations between the old MAX_ROUNDUP and the pool size must not share free lists.
+    void *a = mem.allocRaw(3000, 1);
+    void *b = mem.allocRaw(4000, 1);
+    mem.freeRaw(a);
+    void *c = mem.allocRaw(4000, 1);
+    REQUIRE(c != a);
+    mem.freeRaw(b);
+    mem.freeRaw(c);
+}
+
+TEST_CASE("MemoryManager.PoolGrowth")
+{
+    MemoryManager mem("PoolGrowth");
+
+    // 8 MiB worth of allocations must not need an 8 KiB pool each.
+    Vector<void *> allocs;
+    for(size_t i = 0; i < 8 * 1024; ++i) allocs.push_back(mem.allocRaw(1000, 1));
+    REQUIRE(mem.getPoolCount() < 20);
+    for(auto &alloc : allocs) mem.freeRaw(alloc);
+
+    // Leftover space of the previous pools is reused.
+    size_t poolCount = mem.getPoolCount();
+    for(size_t i = 0; i < 64; ++i) allocs[i] = mem.allocRaw(16, 1);
+    REQUIRE(mem.getPoolCount() == poolCount);
+    for(size_t i = 0; i < 64; ++i) mem.freeRaw(allocs[i]);
+}
+
+TEST_CASE("MemoryManager.LargeCache")
+{
+    MemoryManager mem("LargeCache");
+
+    // Freed large allocations are reused.
+    for(size_t size : {20000, 300000, 4 * 1024 * 1024}) {
+        char *alloc = (char *)mem.allocRaw(size, 1);
+        std::memset(alloc, 0xAB, size);
+        mem.freeRaw(alloc);
+        REQUIRE(mem.getLargeCacheBytes() >= size);
+        char *again = (char *)mem.allocRaw(size, 1);
+        REQUIRE(again == alloc);
+        std::memset(again, 0xCD, size);
+        mem.freeRaw(again);
+    }
+    // A cached block is only reused if it is aligned enough.
+    char *alloc = (char *)mem.allocRaw(3 * 1024 * 1024, 8192);
+    REQUIRE((size_t)alloc % 8192 == 0);
+    mem.freeRaw(alloc);
+
+    // The cache never exceeds its limit.
+    mem.setLargeCacheLimit(1024 * 1024);
+    REQUIRE(mem.getLargeCacheBytes() <= 1024 * 1024);
+    Vector<void *> allocs;
+    for(size_t i = 0; i < 16; ++i) allocs.push_back(mem.allocRaw(500000, 1));
+    for(auto &a : allocs) mem.freeRaw(a);
+    REQUIRE(mem.getLargeCacheBytes() <= 1024 * 1024);
+    mem.setLargeCacheLimit(0);
+    REQUIRE(mem.getLargeCacheBytes() == 0);
+}
+
+TEST_CASE("MemoryManager.HugeSizes")
+{
+    MemoryManager mem("HugeSizes");
+
+    // Sizes which wrap around with the AllocDetail, or exceed the largest size class, fail.
+    for(size_t size : {SIZE_MAX, SIZE_MAX - ALLOC_DETAIL_BYTES + 1, MAX_LARGE_CLASS_SIZE + 1}) {
+        REQUIRE(mem.allocRaw(size, 1) == nullptr);
+        REQUIRE(mem.allocRaw(size, 4096) == nullptr);
+        void *batch[2];
+        REQUIRE(mem.allocBatch(size, 1, batch) == 0);
+    }
+    REQUIRE(mem.allocRaw(MAX_LARGE_CLASS_SIZE - ALLOC_DETAIL_BYTES, 1 << 20) == nullptr);
+
+    // Failing to grow leaves the allocation as is.
+    for(size_t size : {64, 20000, 300000}) {
+        char *alloc = (char *)mem.allocRaw(size, 1);
+        std::memset(alloc, 0xAB, size);
+        REQUIRE(mem.reallocRaw(alloc, SIZE_MAX) == nullptr);
+        REQUIRE(mem.reallocRaw(alloc, MAX_LARGE_CLASS_SIZE) == nullptr);
+        REQUIRE(((unsigned char *)alloc)[size - 1] == 0xAB);
+        mem.freeRaw(alloc);
+    }
+}
+
+TEST_CASE("MemoryManager.Trim")
+{
+    MemoryManager mem("Trim", DEFAULT_POOL_SIZE, MemFlags::SLABS);
+
+    Vector<int *> allocs;
+    for(int i = 0; i < 4000; ++i) {
+        allocs.push_back((int *)mem.allocRaw(1000, 1));
+        allocs.push_back((int *)mem.allocRaw(sizeof(int), alignof(int)));
+    }
+    size_t poolCount = mem.getPoolCount();
+    REQUIRE(poolCount > 2);
+    // Nothing can be released while everything is in use.
+    mem.trim();
+    REQUIRE(mem.getPoolCount() == poolCount);
+    for(auto &alloc : allocs) mem.freeRaw(alloc);
+    void *large = mem.allocRaw(1024 * 1024, 1);
+    mem.freeRaw(large);
+
+    REQUIRE(mem.trim() > 0);
+    REQUIRE(mem.getPoolCount() == 1);
+    REQUIRE(mem.getLargeCacheBytes() == 0);
+    // Released memory must not be handed out anymore, while purged slabs are reused.
+    size_t slabCount = mem.getSlabCount();
+    for(int i = 0; i < 4000; ++i) {
+        allocs[2 * i]      = (int *)mem.allocRaw(1000, 1);
+        allocs[2 * i + 1]  = (int *)mem.allocRaw(sizeof(int), alignof(int));
+        *allocs[2 * i]     = i;
+        *allocs[2 * i + 1] = i;
+    }
+    size_t bad = 0;
+    for(int i = 0; i < 4000; ++i) {
+        if(*allocs[2 * i] != i || *allocs[2 * i + 1] != i) ++bad;
+    }
+    REQUIRE(bad == 0);
+    REQUIRE(mem.getSlabCount() == slabCount);
+    for(auto &alloc : allocs) mem.freeRaw(alloc);
+
+    // Arenas of exited threads are trimmed right away.
+    Thread([&mem]() {
+        Vector<void *> allocs;
+        for(int i = 0; i < 1000; ++i) allocs.push_back(mem.allocRaw(1000, 1));
+        for(auto &alloc : allocs) mem.freeRaw(alloc);
+    }).join();
+    mem.trim();
+    REQUIRE(mem.getPoolCount() == mem.getArenaCount());
+
+    // Background trimming.
+    for(int i = 0; i < 4000; ++i) allocs[i] = (int *)mem.allocRaw(1000, 1);
+    for(int i = 0; i < 4000; ++i) mem.freeRaw(allocs[i]);
+    REQUIRE(mem.getPoolCount() > mem.getArenaCount());
+    mem.setTrimInterval(std::chrono::milliseconds(1));
+    for(int i = 0; i < 1000 && mem.getPoolCount() > mem.getArenaCount(); ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        // The owner trims its arena on its next allocation.
+        mem.freeRaw(mem.allocRaw(2000, 1));
+    }
+    mem.setTrimInterval(std::chrono::milliseconds(0));
+    REQUIRE(mem.getPoolCount() == mem.getArenaCount());
+
+    // Allocations which don't come from the pools trim the arena as well.
+    for(int i = 0; i < 4000; ++i) allocs[i] = (int *)mem.allocRaw(1000, 1);
+    for(int i = 0; i < 4000; ++i) mem.freeRaw(allocs[i]);
+    REQUIRE(mem.getPoolCount() > mem.getArenaCount());
+    Thread([&mem]() { mem.trim(); }).join();
+    mem.freeRaw(mem.allocRaw(sizeof(int), alignof(int)));
+    REQUIRE(mem.getPoolCount() == mem.getArenaCount());
+    for(int i = 0; i < 4000; ++i) allocs[i] = (int *)mem.allocRaw(1000, 1);
+    for(int i = 0; i < 4000; ++i) mem.freeRaw(allocs[i]);
+    Thread([&mem]() { mem.trim(); }).join();
+    mem.freeRaw(mem.allocRaw(1024 * 1024, 1));
+    REQUIRE(mem.getPoolCount() == mem.getArenaCount());
+}
+
+TEST_CASE("MemoryManager.Stats")
+{
+    MemoryManager mem("Stats", DEFAULT_POOL_SIZE, MemFlags::SLABS);
+
+    Vector<void *> allocs;
+    for(size_t i = 0; i < 100; ++i) allocs.push_back(mem.allocRaw(1000, 1));
+    for(size_t i = 0; i < 100; ++i) allocs.push_back(mem.allocRaw(100, 1));
+    allocs.push_back(mem.allocRaw(1024 * 1024, 1));
+    MemStats stats = mem.stats();
+    REQUIRE(stats.allocCount == 201);
+    REQUIRE(stats.freeCount == 0);
+    REQUIRE(stats.requestedBytes == 100 * 1000 + 100 * 100 + 1024 * 1024);
+    REQUIRE(stats.liveBytes == stats.allocBytes);
+    REQUIRE(stats.liveBytes >= stats.requestedBytes);
+    REQUIRE(stats.osBytes >= stats.liveBytes);
+    REQUIRE(stats.peakOsBytes == stats.osBytes);
+    REQUIRE(stats.poolCount == mem.getPoolCount());
+    REQUIRE(stats.slabCount == mem.getSlabCount());
+    REQUIRE(stats.sizeClasses[getSizeClass(1000 + ALLOC_DETAIL_BYTES)].allocCount == 100);
+    REQUIRE(stats.sizeClasses[getSizeClass(100)].allocCount == 100);
+
+    // Frees from other threads are counted once the owner collects them.
+    Thread([&]() {
+        for(size_t i = 0; i < 50; ++i) mem.freeRaw(allocs[i]);
+    }).join();
+    for(size_t i = 50; i < allocs.size(); ++i) mem.freeRaw(allocs[i]);
+    mem.freeRaw(mem.allocRaw(1000, 1));
+    stats = mem.stats();
+    REQUIRE(stats.freeCount == stats.allocCount - 50);
+    REQUIRE(stats.reuseCount == 1);
+    REQUIRE(stats.sizeClasses[getSizeClass(1000 + ALLOC_DETAIL_BYTES)].freeChunks >= 50);
+
+    // trim() collects the remotely freed allocations as well.
+    mem.trim();
+    MemStats trimmed = mem.stats();
+    REQUIRE(trimmed.freeCount == trimmed.allocCount);
+    REQUIRE(trimmed.liveBytes == 0);
+    REQUIRE(trimmed.osBytes < stats.osBytes);
+    REQUIRE(trimmed.peakOsBytes == stats.peakOsBytes);
+    REQUIRE(trimmed.largeCacheBytes == 0);
+}
+
+TEST_CASE("MemoryManager.HeapMap")
+{
+    MemoryManager mem("Heap \"Map\"", DEFAULT_POOL_SIZE, MemFlags::SLABS);
+
+    Vector<void *> allocs(2000);
+    for(size_t i = 0; i < allocs.size(); ++i) allocs[i] = mem.allocRaw(600 + i % 400, 1);
+    HeapMap map = mem.heapMap();
+    REQUIRE(map.arenas.size() == mem.getArenaCount());
+    size_t pools = 0;
+    for(auto &a : map.arenas) {
+        for(auto &p : a.pools) {
+            REQUIRE(p.used <= p.size);
+            ++pools;
+        }
+    }
+    REQUIRE(pools == mem.getPoolCount());
+    double dense = map.fragmentation;
+    REQUIRE(dense < 0.5);
+
+    // Freeing every other allocation leaves holes.
+    for(size_t i = 0; i < allocs.size(); i += 2) mem.freeRaw(allocs[i]);
+    map = mem.heapMap();
+    REQUIRE(map.fragmentation > dense);
+    REQUIRE(map.arenas[0].fragmentation > 0.4);
+    size_t freeChunks = 0;
+    for(auto &c : map.arenas[0].freeChunks) freeChunks += c;
+    REQUIRE(freeChunks >= allocs.size() / 2);
+
+    std::ostringstream json;
+    REQUIRE(mem.writeHeapMap(json, HeapMapFormat::JSON));
+    REQUIRE(json.str().starts_with("{\"name\":\"Heap \\\"Map\\\"\",\"slabCount\":"));
+    REQUIRE(json.str().ends_with("]}]}\n"));
+
+    std::ostringstream bin;
+    REQUIRE(mem.writeHeapMap(bin, HeapMapFormat::BINARY));
+    String data = bin.str();
+    REQUIRE(data.substr(0, 4) == "LCHM");
+    REQUIRE(data[4] == HEAP_MAP_VERSION);
+    size_t expected = 8 + 5 * 8 + SIZE_CLASS_COUNT * 4 * 8 + 8;
+    for(auto &a : map.arenas) expected += 2 * 8 + SIZE_CLASS_COUNT * 8 + 8 + a.pools.size() * 4 * 8;
+    REQUIRE(data.size() == expected);
+
+    for(size_t i = 1; i < allocs.size(); i += 2) mem.freeRaw(allocs[i]);
+}
+
+TEST_CASE("MemoryManager.Threads")
+{
+    MemoryManager mem("Threads");
+
+    constexpr size_t threadCount = 8;
+    constexpr size_t allocCount  = 1000;
+
+    // Each thread frees half of its own allocations, and hands over the other half to be freed
+    // by the next thread.
+    Vector<Vector<size_t *>> handover(threadCount);
+    Vector<Thread> threads;
+    Atomic<bool> failed = false;
+    for(size_t t = 0; t < threadCount; ++t) {
+        threads.emplace_back([&, t]() {
+            Vector<size_t *> allocs;
+            for(size_t i = 0; i < allocCount; ++i) {
+                size_t *alloc =
+                    (size_t *)mem.allocRaw(sizeof(size_t) * (1 + i % 32), alignof(size_t));
+                *alloc = t * allocCount + i;
+                allocs.push_back(alloc);
+            }
+            for(size_t i = 0; i < allocCount; ++i) {
+                if(*allocs[i] != t * allocCount + i) failed = true;
+                if(i % 2) mem.freeRaw(allocs[i]);
+                else handover[t].push_back(allocs[i]);
+            }
+        });
+    }
+    for(auto &t : threads) t.join();
+    threads.clear();
+    REQUIRE(!failed);
+    REQUIRE(mem.getArenaCount() <= threadCount + 1);
+
+    for(size_t t = 0; t < threadCount; ++t) {
+        threads.emplace_back([&, t]() {
+            for(auto &alloc : handover[(t + 1) % threadCount]) mem.freeRaw(alloc);
+            // Allocations must be served from this thread's arena (including the chunks freed by
+            // other threads) without corrupting anything.
+            for(size_t i = 0; i < allocCount; ++i) {
+                size_t *alloc = (size_t *)mem.allocRaw(sizeof(size_t), alignof(size_t));
+                *alloc        = i;
+                if(*alloc != i) failed = true;
+                mem.freeRaw(alloc);
+            }
+        });
+    }
+    for(auto &t : threads) t.join();
+    REQUIRE(!failed);
+    // Arenas of the exited threads must have been reused.
+    REQUIRE(mem.getArenaCount() <= threadCount + 1);
+}
+
+TEST_CASE("MemoryManager.Batch")
+{
+    uint32_t flags = GENERATE(MemFlags::NONE, MemFlags::SLABS, MemFlags::LOCK_FREE);
+    MemoryManager mem("Batch", DEFAULT_POOL_SIZE, flags);
+
+    Vector<void *> allocs(1000);
+    REQUIRE(mem.allocBatch(100, 1, allocs) == allocs.size());
+    Set<void *> unique(allocs.begin(), allocs.end());
+    REQUIRE(unique.size() == allocs.size());
+    for(size_t i = 0; i < allocs.size(); ++i) memset(allocs[i], i % 256, 100);
+    for(size_t i = 0; i < allocs.size(); ++i) REQUIRE(((uint8_t *)allocs[i])[99] == i % 256);
+    REQUIRE(mem.stats().allocCount == allocs.size());
+
+    // Freed allocations are handed out again by the next batch.
+    mem.freeBatch(allocs);
+    MemStats stats = mem.stats();
+    REQUIRE(stats.freeCount == allocs.size());
+    Vector<void *> again(allocs.size());
+    REQUIRE(mem.allocBatch(100, 1, again) == again.size());
+    REQUIRE(mem.stats().osBytes == stats.osBytes);
+    if(flags == MemFlags::NONE) {
+        for(auto &alloc : again) REQUIRE(unique.contains(alloc));
+        REQUIRE(mem.stats().reuseCount == again.size());
+    }
+
+    // Freed by another thread, they go back to this thread's arena.
+    Thread([&]() { mem.freeBatch(again); }).join();
+    mem.trim();
+    REQUIRE(mem.stats().liveBytes == 0);
+
+    allocs.push_back(nullptr);
+    REQUIRE(mem.allocBatch(0, 1, allocs) == 0);
+    REQUIRE(allocs[0] == nullptr);
+    mem.freeBatch(allocs);
+    REQUIRE(mem.allocBatch(1024 * 1024, 1, Span<void *>(allocs.data(), 4)) == 4);
+    mem.freeBatch(allocs);
+    REQUIRE(mem.stats().liveBytes == 0);
+}
+
+TEST_CASE("MemoryManager.Realloc")
+{
+    uint32_t flags = GENERATE(MemFlags::NONE, MemFlags::SLABS, MemFlags::LOCK_FREE);
+    MemoryManager mem("Realloc", DEFAULT_POOL_SIZE, flags);
+
+    auto fill  = [](void *p, size_t n) {
+        for(size_t i = 0; i < n; ++i) ((uint8_t *)p)[i] = i % 251;
+    };
+    auto check = [](void *p, size_t n) {
+        for(size_t i = 0; i < n; ++i) {
+            if(((uint8_t *)p)[i] != i % 251) return false;
+        }
+        return true;
+    };
+
+    REQUIRE(mem.reallocRaw(nullptr, 0) == nullptr);
+    // Fits in the size class.
+    void *a = mem.reallocRaw(nullptr, 100);
+    fill(a, 100);
+    REQUIRE(mem.reallocRaw(a, 110) == a);
+    REQUIRE(mem.reallocRaw(a, 50) == a);
+    REQUIRE(check(a, 50));
+
+    // The last allocation carved from the pool grows at the pool's head.
+    void *b = mem.allocRaw(600, 1);
+    fill(b, 600);
+    void *grown = mem.reallocRaw(b, 2000);
+    if(flags == MemFlags::NONE) REQUIRE(grown == b);
+    REQUIRE(check(grown, 600));
+
+    // Anything else is moved, keeping its alignment.
+    void *c = mem.allocRaw(100, 128);
+    fill(c, 100);
+    void *moved = mem.reallocRaw(c, 5000);
+    REQUIRE((size_t)moved % 128 == 0);
+    REQUIRE(check(moved, 100));
+
+    // Large allocations.
+    void *l = mem.allocRaw(512 * 1024, 1);
+    fill(l, 512 * 1024);
+    l = mem.reallocRaw(l, 4 * 1024 * 1024);
+    REQUIRE(check(l, 512 * 1024));
+    fill(l, 4 * 1024 * 1024);
+    l = mem.reallocRaw(l, 6 * 1024 * 1024);
+    REQUIRE(check(l, 4 * 1024 * 1024));
+
+    REQUIRE(mem.reallocRaw(a, 0) == nullptr);
+    mem.freeRaw(grown);
+    mem.freeRaw(moved);
+    mem.freeRaw(l);
+    MemStats stats = mem.stats();
+    REQUIRE(stats.liveBytes == 0);
+    REQUIRE(stats.freeCount == stats.allocCount);
+}
+
+TEST_CASE("MemoryManager.RemoteFree")
+{
+    MemoryManager mem("RemoteFree", DEFAULT_POOL_SIZE, GENERATE(MemFlags::NONE, MemFlags::SLABS));
+
+    // The producer keeps allocating while the consumer frees what it produced.
+    constexpr size_t count = 100000;
+    Vector<Atomic<void *>> queue(count);
+    Atomic<size_t> produced = 0;
+    Thread consumer([&]() {
+        Vector<void *> batch;
+        for(size_t i = 0; i < count; ++i) {
+            while(produced.load(std::memory_order_acquire) <= i) std::this_thread::yield();
+            void *alloc = queue[i].load(std::memory_order_relaxed);
+            if(i % 2) mem.freeRaw(alloc);
+            else batch.push_back(alloc);
+            if(batch.size() == 64) {
+                mem.freeBatch(batch);
+                batch.clear();
+            }
+        }
+        mem.freeBatch(batch);
+    });
+    for(size_t i = 0; i < count; ++i) {
+        queue[i].store(mem.allocRaw(16 + i % 200, 1), std::memory_order_relaxed);
+        produced.store(i + 1, std::memory_order_release);
+    }
+    consumer.join();
+
+    mem.trim();
+    MemStats stats = mem.stats();
+    REQUIRE(stats.freeCount == stats.allocCount);
+    REQUIRE(stats.liveBytes == 0);
+}
+
+TEST_CASE("MemoryManager.LockFree")
+{
+    MemoryManager mem("LockFree", DEFAULT_POOL_SIZE, MemFlags::LOCK_FREE);
+
+    constexpr size_t threadCount = 8;
+    constexpr size_t allocCount  = 2000;
+
+    Vector<Thread> threads;
+    Atomic<bool> failed = false;
+    for(size_t t = 0; t < threadCount; ++t) {
+        threads.emplace_back([&, t]() {
+            Vector<size_t *> allocs;
+            for(size_t round = 0; round < 4; ++round) {
+                for(size_t i = 0; i < allocCount; ++i) {
+                    size_t *alloc = (size_t *)mem.allocRaw(sizeof(size_t) * (1 + i % 8), 8);
+                    *alloc        = t * allocCount + i;
+                    allocs.push_back(alloc);
+                }
+                for(size_t i = 0; i < allocCount; ++i) {
+                    if(*allocs[i] != t * allocCount + i) failed = true;
+                    mem.freeRaw(allocs[i]);
+                }
+                allocs.clear();
+            }
+        });
+    }
+    for(auto &t : threads) t.join();
+    REQUIRE(!failed);
+    // Threads only own arenas for their counters, so the sums must still add up.
+    MemStats stats = mem.stats();
+    REQUIRE(stats.allocCount == threadCount * allocCount * 4);
+    REQUIRE(stats.freeCount == stats.allocCount);
+    REQUIRE(stats.liveBytes == 0);
+}
+
+TEST_CASE("MemoryManager.Persistent")
+{
+    Path file = fs::temp_directory_path() / "LibCorePersistentTest.heap";
+    fs::remove(file);
+
+    constexpr size_t count = 1000;
+    void *freed            = nullptr;
+    {
+        MemoryManager mem("Persistent", file, 64 * 1024 * 1024);
+        REQUIRE(mem.isPersistent());
+        ManagedRawList list(mem, "list");
+        for(size_t i = 0; i < count; ++i) *list.alloc<size_t>(1 + i % 20) = i;
+        size_t *big = (size_t *)mem.allocRaw(2 * 1024 * 1024, 64);
+        for(size_t i = 0; i < 1024; ++i) big[i] = i * 3;
+        REQUIRE(mem.setRoot("list", list.release()));
+        REQUIRE(mem.setRoot("big", big));
+        REQUIRE(!mem.setRoot("", big));
+        REQUIRE(mem.getRoot("none") == nullptr);
+        freed = mem.allocRaw(100, 1);
+        mem.freeRaw(freed);
+    }
+    {
+        MemoryManager mem("Persistent", file, 64 * 1024 * 1024);
+        REQUIRE(mem.isPersistent());
+        MemStats stats = mem.stats();
+        REQUIRE(stats.allocCount == count + 2);
+        REQUIRE(stats.freeCount == 1);
+        // Free chunks are saved along with the allocations.
+        void *alloc = mem.allocRaw(100, 1);
+        REQUIRE(alloc == freed);
+        mem.freeRaw(alloc);
+
+        {
+            // The index of the list is allocated from mem as well, until the list is destroyed.
+            ManagedRawList list(mem, "list", true);
+            REQUIRE(list.adopt(mem.getRoot("list")) == count);
+            for(size_t i = 0; i < count; ++i) REQUIRE(*(size_t *)list.at(i) == i);
+            REQUIRE(list.clear() == count);
+        }
+        size_t *big = (size_t *)mem.getRoot("big");
+        for(size_t i = 0; i < 1024; ++i) REQUIRE(big[i] == i * 3);
+        REQUIRE(mem.setRoot("big", nullptr));
+        REQUIRE(mem.getRoot("big") == nullptr);
+        mem.freeRaw(big);
+        REQUIRE(mem.setRoot("list", nullptr));
+        REQUIRE(mem.stats().liveBytes == 0);
+    }
+    {
+        // Files which aren't a persistent heap are left alone.
+        OFStream(file) << "not a heap";
+        MemoryManager mem("Persistent", file, 64 * 1024 * 1024);
+        REQUIRE(!mem.isPersistent());
+    }
+    fs::remove(file);
+}
+
+TEST_CASE("MemoryManager.Slabs")
+{
+    MemoryManager mem("Slabs", DEFAULT_POOL_SIZE, MemFlags::SLABS);
+
+    constexpr size_t allocCount = 10000;
+
+    Vector<int *> allocs;
+    for(size_t i = 0; i < allocCount; ++i) {
+        int *alloc = (int *)mem.allocRaw(sizeof(int), alignof(int));
+        REQUIRE(((uintptr_t)alloc) % MAX_ALIGNMENT == 0);
+        *alloc = i;
+        allocs.push_back(alloc);
+    }
+    // No per allocation header - each int takes up MAX_ALIGNMENT bytes.
+    size_t slabCount = mem.getSlabCount();
+    REQUIRE(slabCount <= allocCount * MAX_ALIGNMENT / (SLAB_SIZE - SLAB_HEADER_BYTES) + 1);
+    REQUIRE(mem.getPoolCount() == 1);
+    for(size_t i = 0; i < allocCount; ++i) REQUIRE(*allocs[i] == (int)i);
+
+    // Free from another thread, and then reuse the slabs.
+    Thread([&]() {
+        for(auto &alloc : allocs) mem.freeRaw(alloc);
+    }).join();
+    for(size_t i = 0; i < allocCount; ++i) {
+        allocs[i]  = (int *)mem.allocRaw(sizeof(int) * (1 + i % 4), alignof(int));
+        *allocs[i] = i;
+    }
+    REQUIRE(mem.getSlabCount() <= slabCount * 2);
+    for(size_t i = 0; i < allocCount; ++i) {
+        REQUIRE(*allocs[i] == (int)i);
+        mem.freeRaw(allocs[i]);
+    }
+
+    // Larger allocations still come from the pools.
+    char *big = (char *)mem.allocRaw(SLAB_MAX_OBJECT + 1, 1);
+    REQUIRE(mem.getAllocDetail((size_t)big, AllocDetails::SIZE) >= SLAB_MAX_OBJECT + 1);
+    mem.freeRaw(big);
+
+    ManagedList list(mem, "SlabList");
+    ManagedRawList rawList(mem, "SlabRawList");
+    for(int i = 0; i < 100; ++i) {
+        REQUIRE(list.alloc<Test>(i)->p == i);
+        *rawList.alloc<int>() = i;
+    }
+    REQUIRE(list.size() == 100);
+    REQUIRE(((Test *)list.at(50))->p == 50);
+    REQUIRE(*(int *)rawList.at(99) == 99);
+    REQUIRE(list.free(10));
+    REQUIRE(((Test *)list.at(10))->p == 11);
+    REQUIRE(rawList.clear() == 100);
+}
+
+TEST_CASE("MemoryManager.SlabsTraceLog")
+{
+    // Slab allocations are logged at TRACE, which must format the (32-bit) object size.
+    LogLevels::LogLevels oldLevel = logger.getLevel();
+    logger.setLevel(LogLevels::TRACE);
+    {
+        MemoryManager mem("SlabsTrace", DEFAULT_POOL_SIZE, MemFlags::SLABS);
+        char *alloc = (char *)mem.allocRaw(24, 8);
+        REQUIRE(alloc != nullptr);
+        REQUIRE(mem.getSlabCount() == 1);
+        mem.freeRaw(alloc);
+    }
+    logger.setLevel(oldLevel);
+}
+
+TEST_CASE("MemoryManager.Alignment")
+{
+    struct alignas(64) Aligned : public IAllocated
+    {
+        int p;
+        Aligned(int p) : p(p) {}
+    };
+
+    for(uint32_t flags : {MemFlags::NONE, MemFlags::SLABS, MemFlags::LOCK_FREE}) {
+        MemoryManager mem("Alignment", DEFAULT_POOL_SIZE, flags);
+        size_t misaligned = 0;
+        for(size_t align = 1; align <= 4096; align *= 2) {
+            for(size_t size : {1, 24, 100, 500, 3000, 100000}) {
+                Vector<char *> allocs;
+                for(size_t i = 0; i < 4; ++i) {
+                    char *alloc = (char *)mem.allocRaw(size, align);
+                    if((size_t)alloc % align != 0) ++misaligned;
+                    std::memset(alloc, 0xAB, size);
+                    allocs.push_back(alloc);
+                }
+                // Freed chunks must only be reused for allocations with the same alignment.
+                for(auto &alloc : allocs) mem.freeRaw(alloc);
+                for(auto &alloc : allocs) alloc = (char *)mem.allocRaw(size, align);
+                for(auto &alloc : allocs) {
+                    if((size_t)alloc % align != 0) ++misaligned;
+                    std::memset(alloc, 0xCD, size);
+                    mem.freeRaw(alloc);
+                }
+            }
+        }
+        REQUIRE(misaligned == 0);
+
+        Aligned *obj = mem.allocInit<Aligned>(5);
+        REQUIRE((size_t)obj % 64 == 0);
+        REQUIRE(obj->p == 5);
+        mem.freeDeinit(obj);
+
+        ManagedList list(mem, "AlignedList");
+        for(int i = 0; i < 100; ++i) {
+            Aligned *item = list.alloc<Aligned>(i);
+            if((size_t)item % 64 != 0) ++misaligned;
+        }
+        REQUIRE(misaligned == 0);
+        REQUIRE(list.size() == 100);
+        list.clear();
+    }
+}
+
+TEST_CASE("MemResource.Basic")
+{
+    MemoryManager mem("MemResource");
+
+    {
+        pmr::Vector<int> vec(&mem.getResource());
+        for(int i = 0; i < 1000; ++i) vec.push_back(i);
+        pmr::String str("a string which is too long for the small string buffer",
+                        &mem.getResource());
+        pmr::StringMap<int> map(&mem.getResource());
+        map[str] = 5;
+        REQUIRE(map.find(StringRef(str)) != map.end());
+        // Nested containers get their memory from the same resource.
+        pmr::Vector<pmr::String> strs(&mem.getResource());
+        strs.emplace_back(str);
+        REQUIRE(strs[0].get_allocator().resource() == &mem.getResource());
+
+        std::vector<int, ManagedAllocator<int>> managedVec(mem);
+        for(int i = 0; i < 1000; ++i) managedVec.push_back(i);
+        REQUIRE(managedVec[999] == 999);
+        REQUIRE(vec[999] == 999);
+        MemStats stats = mem.stats();
+        REQUIRE(stats.allocCount > 10);
+        REQUIRE(stats.liveBytes > 0);
+    }
+    REQUIRE(mem.stats().liveBytes == 0);
+
+    MemoryManager other("MemResource2");
+    REQUIRE(mem.getResource() == mem.getResource());
+    REQUIRE(mem.getResource() != other.getResource());
+    REQUIRE(ManagedAllocator<int>(mem) == ManagedAllocator<char>(mem));
+    REQUIRE(ManagedAllocator<int>(mem) != ManagedAllocator<int>(other));
+}
+
 TEST_CASE("ManagedList.Basic")
 {
     MemoryManager mem("Basic");
@@ -34,6 +714,20 @@ TEST_CASE("ManagedList.Basic")
     Test *res = allocator.alloc<Test>(5);
 
     REQUIRE(res->p == 5);
+
+    static size_t destroyed;
+    struct Counted : public IAllocated
+    {
+        ~Counted() { ++destroyed; }
+    };
+    destroyed = 0;
+    for(size_t i = 0; i < 1000; ++i) allocator.alloc<Counted>();
+    REQUIRE(allocator.size() == 1001);
+    REQUIRE(allocator.clear() == 1001);
+    REQUIRE(destroyed == 1000);
+    REQUIRE(allocator.empty());
+    REQUIRE(allocator.getEnd() == nullptr);
+    REQUIRE(mem.stats().liveBytes == 0);
 }
 
 TEST_CASE("ManagedRawList.Basic")
@@ -80,4 +774,63 @@ TEST_CASE("ManagedRawList.Basic")
     }
     REQUIRE((allocator2->clear() == 1));
     mem.freeDeinit(allocator2);
-}
\ No newline at end of file
+}
+
+TEST_CASE("ManagedRawList.Indexed")
+{
+    MemoryManager mem("Indexed", DEFAULT_POOL_SIZE, MemFlags::SLABS);
+    bool indexed = GENERATE(false, true);
+    ManagedRawList list(mem, "Indexed", indexed);
+    REQUIRE(list.isIndexed() == indexed);
+
+    Vector<int *> expected;
+    for(int i = 0; i < 1000; ++i) {
+        expected.push_back(list.allocInit<int>(&i));
+        REQUIRE(list.at(i) == expected.back());
+    }
+    REQUIRE(list.at(expected.size()) == nullptr);
+
+    // Remove by pointer and by index, from the front, the back and the middle.
+    for(size_t i = 0; i < 300; ++i) {
+        size_t idx = (i * 7919) % expected.size();
+        if(i % 2) REQUIRE(list.free(idx));
+        else REQUIRE(list.free(expected[idx]));
+        expected.erase(expected.begin() + idx);
+    }
+    list.free((size_t)0);
+    expected.erase(expected.begin());
+    list.free(expected.back());
+    expected.pop_back();
+    REQUIRE(!list.free(expected.size()));
+
+    REQUIRE(list.size() == expected.size());
+    for(size_t i = 0; i < expected.size(); ++i) REQUIRE(list.at(i) == expected[i]);
+    size_t i = 0;
+    for(void *it = list.next(); it; it = list.next(it)) REQUIRE(it == expected[i++]);
+
+    // Removing everything must leave the list usable.
+    while(!list.empty()) list.free((size_t)0);
+    REQUIRE(list.getStart() == nullptr);
+    REQUIRE(list.getEnd() == nullptr);
+    int v     = 5;
+    int *last = list.allocInit<int>(&v);
+    REQUIRE(list.at(0) == last);
+    REQUIRE(list.getEnd() == last);
+    REQUIRE(list.clear() == 1);
+    REQUIRE(list.at(0) == nullptr);
+}
+
+TEST_CASE("ManagedRawList.IndexMemory")
+{
+    // The index of a list is allocated from the manager of the list, and given back to it.
+    MemoryManager mem("IndexMemory");
+    size_t plainBytes = 0;
+    for(bool indexed : {false, true}) {
+        ManagedRawList list(mem, "IndexMemory", indexed);
+        for(int i = 0; i < 100; ++i) list.allocInit<int>(&i);
+        if(!indexed) plainBytes = mem.stats().liveBytes;
+        else REQUIRE(mem.stats().liveBytes > plainBytes);
+        REQUIRE(list.clear() == 100);
+    }
+    REQUIRE(mem.stats().liveBytes == 0);
+}
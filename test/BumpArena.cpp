@@ -0,0 +1,101 @@
+#include "BumpArena.hpp"
+
+#include <catch2/catch_all.hpp>
+
+using namespace core;
+
+struct Counted
+{
+    int &count;
+    int value;
+
+    Counted(int &count, int value) : count(count), value(value) { ++count; }
+    ~Counted() { --count; }
+};
+
+TEST_CASE("BumpArena.Basic")
+{
+    MemoryManager mem("BumpArena");
+    BumpArena arena(mem, 1024);
+
+    Vector<int *> ints;
+    for(int i = 0; i < 1000; ++i) ints.push_back(arena.alloc<int>(i));
+    size_t bad = 0;
+    for(int i = 0; i < 1000; ++i) {
+        if(*ints[i] != i || (size_t)ints[i] % alignof(int) != 0) ++bad;
+    }
+    REQUIRE(bad == 0);
+    // Aligned and larger than a block.
+    char *big = (char *)arena.allocRaw(5000, 256);
+    REQUIRE((size_t)big % 256 == 0);
+    std::memset(big, 0xAB, 5000);
+
+    // Blocks are reused after a reset.
+    size_t reserved = arena.getReservedBytes();
+    arena.reset();
+    for(int i = 0; i < 1000; ++i) arena.alloc<int>(i);
+    arena.allocRaw(5000, 256);
+    REQUIRE(arena.getReservedBytes() == reserved);
+}
+
+TEST_CASE("BumpArena.Destructors")
+{
+    MemoryManager mem("BumpArena");
+    BumpArena arena(mem);
+
+    int count = 0;
+    for(int i = 0; i < 100; ++i) arena.alloc<Counted>(count, i);
+    REQUIRE(count == 100);
+    {
+        BumpArena::Scope scope(arena);
+        for(int i = 0; i < 1000; ++i) {
+            Counted *c = arena.alloc<Counted>(count, i);
+            if(c->value != i) --count;
+        }
+        REQUIRE(count == 1100);
+    }
+    // Only the objects allocated within the scope are destroyed.
+    REQUIRE(count == 100);
+
+    BumpArena::Marker marker = arena.mark();
+    arena.alloc<Counted>(count, 0);
+    arena.rewind(marker);
+    REQUIRE(count == 100);
+
+    arena.reset();
+    REQUIRE(count == 0);
+    {
+        BumpArena other(mem);
+        other.alloc<Counted>(count, 0);
+        REQUIRE(count == 1);
+    }
+    REQUIRE(count == 0);
+}
+
+TEST_CASE("BumpArena.OutOfMemory")
+{
+    Path file = fs::temp_directory_path() / "LibCoreBumpArenaTest.heap";
+    fs::remove(file);
+    {
+        // The blocks come from a persistent manager, which cannot grow beyond its file.
+        MemoryManager mem("BumpArena", file, 4 * 1024 * 1024);
+        REQUIRE(mem.isPersistent());
+        BumpArena arena(mem, 256 * 1024);
+
+        int count   = 0;
+        size_t made = 0;
+        while(arena.allocRaw(100 * 1024, MAX_ALIGNMENT)) ++made;
+        REQUIRE(made > 0);
+        REQUIRE(made < 64);
+        REQUIRE(arena.allocRaw(SIZE_MAX, 1) == nullptr);
+        // What is left of the current block is still usable.
+        REQUIRE(arena.alloc<Counted>(count, 1)->value == 1);
+        REQUIRE(count == 1);
+        // Rewinding makes the blocks usable again.
+        arena.reset();
+        REQUIRE(arena.alloc<Counted>(count, 2)->value == 2);
+        arena.reset();
+        REQUIRE(count == 0);
+    }
+    fs::remove(file);
+}
@@ -0,0 +1,86 @@
+#include "Allocator.hpp"
+
+#include <catch2/catch_all.hpp>
+
+using namespace core;
+
+TEST_CASE("HeapProfiler.Basic")
+{
+    MemoryManager mem("HeapProfiler");
+    std::ostringstream os;
+    REQUIRE(mem.getProfiler() == nullptr);
+    REQUIRE(!mem.writeProfile(os, ProfileFormat::FOLDED));
+
+    // Every allocation is sampled.
+    mem.setSampleInterval(1);
+    Vector<void *> allocs;
+    for(size_t i = 0; i < 100; ++i) allocs.push_back(mem.allocRaw(64, 1));
+    HeapProfiler *prof = mem.getProfiler();
+    REQUIRE(prof != nullptr);
+    REQUIRE(prof->getSampleCount() == 100);
+
+    REQUIRE(mem.writeProfile(os, ProfileFormat::PPROF));
+    String pprof = os.str();
+    REQUIRE(pprof.starts_with("heap profile: 100: 6400 [100: 6400] @ heap_v2/1\n"));
+    REQUIRE(pprof.find("\nMAPPED_LIBRARIES:\n") != String::npos);
+
+    os.str("");
+    REQUIRE(mem.writeProfile(os, ProfileFormat::FOLDED));
+    String folded = os.str();
+    REQUIRE(!folded.empty());
+    REQUIRE(folded.back() == '\n');
+
+    // Freed samples are dropped, in any way they are freed.
+    for(size_t i = 0; i < 50; ++i) mem.freeRaw(allocs[i]);
+    REQUIRE(prof->getSampleCount() == 50);
+    Thread([&]() { mem.freeBatch(Span<void *>(allocs.data() + 50, 50)); }).join();
+    REQUIRE(prof->getSampleCount() == 0);
+
+    // Nothing is sampled once stopped.
+    mem.setSampleInterval(0);
+    mem.freeRaw(mem.allocRaw(64, 1));
+    os.str("");
+    REQUIRE(mem.writeProfile(os, ProfileFormat::FOLDED));
+    REQUIRE(os.str().empty());
+}
+
+TEST_CASE("HeapProfiler.Realloc")
+{
+    MemoryManager mem("HeapProfiler");
+    mem.setSampleInterval(1);
+    HeapProfiler *prof = mem.getProfiler();
+
+    // Remapped large blocks (which usually move) and allocations grown in place keep their sample,
+    // at the new address and size.
+    for(size_t size : {300000, 100}) {
+        void *alloc   = mem.allocRaw(size, 1);
+        size_t newSz  = size == 100 ? 120 : 64 * 1024 * 1024;
+        void *resized = mem.reallocRaw(alloc, newSz);
+        REQUIRE(resized != nullptr);
+        REQUIRE(prof->getSampleCount() == 1);
+        std::ostringstream os;
+        REQUIRE(mem.writeProfile(os, ProfileFormat::PPROF));
+        REQUIRE(os.str().starts_with("heap profile: 1: " + std::to_string(newSz) + " ["));
+        REQUIRE(prof->getLiveEstimate() == newSz);
+        mem.freeRaw(resized);
+        REQUIRE(prof->getSampleCount() == 0);
+    }
+}
+
+TEST_CASE("HeapProfiler.Estimate")
+{
+    MemoryManager mem("HeapProfiler", DEFAULT_POOL_SIZE, MemFlags::SLABS);
+    mem.setSampleInterval(16 * 1024);
+
+    Vector<void *> allocs(20000);
+    for(size_t i = 0; i < allocs.size(); i += 100) {
+        mem.allocBatch(100 + i % 300, 1, Span<void *>(allocs.data() + i, 100));
+    }
+    size_t requested = mem.stats().requestedBytes;
+    size_t estimate  = mem.getProfiler()->getLiveEstimate();
+    // About 150 samples, so the estimate must be well within 50%.
+    REQUIRE(estimate > requested / 2);
+    REQUIRE(estimate < requested * 3 / 2);
+    mem.freeBatch(allocs);
+    REQUIRE(mem.getProfiler()->getSampleCount() == 0);
+}
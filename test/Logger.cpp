@@ -0,0 +1,303 @@
+#include "Logger.hpp"
+#include "Status.hpp"
+
+#include <catch2/catch_all.hpp>
+
+using namespace core;
+
+static Vector<String> getLines(const String &data)
+{
+    Vector<String> lines;
+    std::istringstream in(data);
+    for(String line; std::getline(in, line);) lines.push_back(line);
+    return lines;
+}
+
+static size_t countLines(const String &data, StringRef term)
+{
+    size_t count = 0;
+    for(auto &line : getLines(data)) {
+        if(line.find(term) != String::npos) ++count;
+    }
+    return count;
+}
+
+TEST_CASE("Logger.Basic")
+{
+    std::ostringstream out;
+    Logger log;
+    log.addSink(&out, false, false);
+    log.setLevel(LogLevels::INFO);
+    log.info("value: ", 5);
+    log.debug("not logged");
+    REQUIRE(out.str().ends_with("][INFO]: value: 5\n"));
+    REQUIRE(countLines(out.str(), "not logged") == 0);
+}
+
+TEST_CASE("Logger.Async")
+{
+    std::ostringstream out;
+    Logger log;
+    log.addSink(&out, false, false);
+    log.setLevel(LogLevels::INFO);
+    REQUIRE(log.setAsync(64));
+    REQUIRE(log.isAsync());
+    REQUIRE(!log.setAsync());
+
+    // The queue is much smaller than the records logged, so the threads block on it.
+    constexpr size_t threadCount = 4;
+    constexpr size_t recordCount = 2000;
+    Vector<Thread> threads;
+    for(size_t t = 0; t < threadCount; ++t) {
+        threads.emplace_back([&log, t]() {
+            for(size_t i = 0; i < recordCount; ++i) log.info("thread ", t, " record ", i);
+        });
+    }
+    for(auto &t : threads) t.join();
+    log.flush();
+    REQUIRE(countLines(out.str(), "record") == threadCount * recordCount);
+    REQUIRE(log.getDroppedCount() == 0);
+    // Each thread's records are written in order.
+    String data = out.str();
+    REQUIRE(data.find("thread 0 record 10\n") < data.find("thread 0 record 11\n"));
+}
+
+TEST_CASE("Logger.AsyncDrop")
+{
+    std::ostringstream out;
+    {
+        Logger log;
+        log.addSink(&out, false, false);
+        log.setLevel(LogLevels::INFO);
+        log.setAsync(4, LogOverflow::DROP_AND_COUNT);
+        constexpr size_t recordCount = 10000;
+        for(size_t i = 0; i < recordCount; ++i) log.info("record ", i);
+        log.flush();
+        REQUIRE(countLines(out.str(), "record ") + log.getDroppedCount() == recordCount);
+    }
+    // Destroying the logger writes out the drop count if it hasn't been already.
+    if(countLines(out.str(), "record ") < 10000) {
+        REQUIRE(countLines(out.str(), "log records as the queue was full") > 0);
+    }
+}
+
+TEST_CASE("Logger.Binary")
+{
+    Path file = fs::temp_directory_path() / "LibCoreLoggerTest.bin";
+    String name(40, 'x');
+    auto logAll = [&](Logger &log, size_t t) {
+        for(size_t i = 0; i < 1000; ++i) {
+            LOG_OBJ_INFO(log, "thread ", t, " record ", i, ' ', 1.5, " ", true, " ", name, " ",
+                         (uint8_t)7, " ", StringRef("ref"), " ", file, " ", (int64_t)-i);
+            LOG_OBJ_DEBUG(log, "not logged");
+        }
+    };
+
+    std::ostringstream text;
+    {
+        Logger log;
+        log.addSink(&text, false, false);
+        log.setLevel(LogLevels::INFO);
+        logAll(log, 0);
+    }
+    {
+        Logger log;
+        log.setLevel(LogLevels::INFO);
+        REQUIRE(log.setBinary(file));
+        REQUIRE(log.isBinary());
+        REQUIRE(!log.setBinary(file));
+        Vector<Thread> threads;
+        for(size_t t = 0; t < 4; ++t) threads.emplace_back([&, t]() { logAll(log, t); });
+        for(auto &t : threads) t.join();
+    }
+
+    std::ostringstream decoded;
+    {
+        IFStream in(file, std::ios::binary);
+        REQUIRE(decodeBinaryLog(in, decoded));
+    }
+    fs::remove(file);
+    REQUIRE(countLines(decoded.str(), "record") == 4 * 1000);
+    REQUIRE(countLines(decoded.str(), "not logged") == 0);
+    // The decoded records read the same as the ones formatted right away.
+    Vector<String> expected, actual;
+    for(auto &line : getLines(text.str())) expected.push_back(line.substr(line.find("]: ")));
+    for(auto &line : getLines(decoded.str())) {
+        if(line.find("thread 0 ") != String::npos) actual.push_back(line.substr(line.find("]: ")));
+    }
+    REQUIRE(actual == expected);
+}
+
+TEST_CASE("Logger.Format")
+{
+    REQUIRE(utils::format("{} + {} = {}", 1, 2.5, 3.5f) == "1 + 2.5 = 3.5");
+    REQUIRE(utils::format("{{{}}} {} {}", "braces", true, 'c') == "{braces} true c");
+    REQUIRE(utils::format("{}:{}", String("a"), StringRef("b")) == "a:b");
+    REQUIRE(utils::format("no args }}") == "no args }");
+    auto status = Status<bool>::fmt(false, "invalid value: {}", -3);
+    REQUIRE(!status.getCode());
+    REQUIRE(status.getMsg() == "invalid value: -3");
+
+    std::ostringstream out;
+    Logger log;
+    log.addSink(&out, false, false);
+    log.setLevel(LogLevels::INFO);
+    REQUIRE(log.setAsync(16));
+    for(int i = 0; i < 100; ++i) LOGF_OBJ_INFO(log, "record {} of {}", i, (size_t)100);
+    LOGF_OBJ_DEBUG(log, "not logged {}", 0);
+    log.flush();
+    REQUIRE(countLines(out.str(), "not logged") == 0);
+    REQUIRE(countLines(out.str(), " of 100") == 100);
+    REQUIRE(out.str().ends_with("][INFO]: record 99 of 100\n"));
+}
+
+TEST_CASE("Logger.FormatBinary")
+{
+    Path file = fs::temp_directory_path() / "LibCoreLoggerFormatTest.bin";
+    auto logAll = [&](Logger &log) {
+        for(int i = 0; i < 100; ++i) {
+            LOGF_OBJ_INFO(log, "{{record}} {}: {} {} {} {}", i, 0.1, false, file, (uint16_t)9);
+            LOG_OBJ_INFO(log, "plain ", i);
+        }
+    };
+
+    std::ostringstream text;
+    {
+        Logger log;
+        log.addSink(&text, false, false);
+        log.setLevel(LogLevels::INFO);
+        logAll(log);
+    }
+    {
+        Logger log;
+        log.setLevel(LogLevels::INFO);
+        REQUIRE(log.setBinary(file));
+        logAll(log);
+    }
+
+    std::ostringstream decoded;
+    {
+        IFStream in(file, std::ios::binary);
+        REQUIRE(decodeBinaryLog(in, decoded));
+    }
+    fs::remove(file);
+    Vector<String> expected, actual;
+    for(auto &line : getLines(text.str())) expected.push_back(line.substr(line.find("]: ")));
+    for(auto &line : getLines(decoded.str())) actual.push_back(line.substr(line.find("]: ")));
+    REQUIRE(actual.size() == 200);
+    REQUIRE(actual == expected);
+}
+
+TEST_CASE("Logger.Categories")
+{
+    std::ostringstream out;
+    Logger log;
+    log.addSink(&out, false, false);
+    log.setLevel(LogLevels::FATAL);
+    LogCategory net("test.net", LogLevels::WARN, log);
+    LogCategory db("test.db", LogLevels::WARN, log);
+    auto names = getLogCategories();
+    REQUIRE(std::count(names.begin(), names.end(), "test.net") == 1);
+
+    // Arguments of statements which are not logged are not evaluated.
+    int calls  = 0;
+    auto count = [&calls]() { return ++calls; };
+    LOG_CAT_TRACE(net, "net trace ", count());
+    REQUIRE(calls == 0);
+    REQUIRE(setLogCategoryLevel("test.net", LogLevels::TRACE));
+    REQUIRE(!setLogCategoryLevel("test.none", LogLevels::TRACE));
+    LOG_CAT_TRACE(net, "net trace ", count());
+    LOGF_CAT_DEBUG(db, "db debug {}", count());
+    LOGF_CAT_WARN(db, "db warn {}", 1);
+    // The level of the logger doesn't matter.
+    REQUIRE(countLines(out.str(), "db warn 1") == 1);
+    REQUIRE(countLines(out.str(), "db debug") == 0);
+    if constexpr(isLogLevelCompiled(LogLevels::TRACE)) {
+        REQUIRE(calls == 1);
+        REQUIRE(countLines(out.str(), "net trace 1") == 1);
+    } else {
+        REQUIRE(calls == 0);
+    }
+}
+
+static void logSiteHelper(Logger &log, int i)
+{
+    LOG_OBJ_DEBUG(log, "helper debug ", i);
+    LOGF_OBJ_WARN(log, "helper warn {}", i);
+}
+
+TEST_CASE("Logger.SiteModes")
+{
+    // The DEBUG statement of the helper must be compiled in.
+    if constexpr(!isLogLevelCompiled(LogLevels::DEBUG)) return;
+
+    std::ostringstream out;
+    Logger log;
+    log.addSink(&out, false, false);
+    log.setLevel(LogLevels::WARN);
+
+    // Rules also apply to the sites which haven't been reached yet.
+    REQUIRE(setLogSiteMode("", "logSite*", LogSiteMode::ENABLED) == 0);
+    logSiteHelper(log, 1);
+    REQUIRE(countLines(out.str(), "helper debug 1") == 1);
+    REQUIRE(countLines(out.str(), "helper warn 1") == 1);
+    size_t helperSites = 0;
+    for(auto &site : getLogSites()) {
+        if(StringRef(site->function) == "logSiteHelper") ++helperSites;
+    }
+    REQUIRE(helperSites == 2);
+
+    REQUIRE(setLogSiteMode("*/Logger.cpp", "logSiteHelper", LogSiteMode::DISABLED) == 2);
+    logSiteHelper(log, 2);
+    REQUIRE(countLines(out.str(), "helper") == 2);
+
+    REQUIRE(setLogSiteMode("Logger.cpp", "", LogSiteMode::ENABLED) >= 2);
+    logSiteHelper(log, 3);
+    REQUIRE(countLines(out.str(), "helper") == 4);
+
+    // Back to the level of the logger.
+    setLogSiteMode("", "", LogSiteMode::DEFAULT);
+    logSiteHelper(log, 4);
+    REQUIRE(countLines(out.str(), "helper debug 4") == 0);
+    REQUIRE(countLines(out.str(), "helper warn 4") == 1);
+}
+
+static void logSiteBindingHelper(Logger &log, int i) { LOG_OBJ_DEBUG(log, "binding debug ", i); }
+
+TEST_CASE("Logger.SiteBinding")
+{
+    if constexpr(!isLogLevelCompiled(LogLevels::DEBUG)) return;
+
+    std::ostringstream out;
+    // The site is bound to the first logger, and follows its level.
+    {
+        Logger first;
+        first.addSink(&out, false, false);
+        first.setLevel(LogLevels::WARN);
+        logSiteBindingHelper(first, 1);
+        first.setLevel(LogLevels::DEBUG);
+        logSiteBindingHelper(first, 2);
+        first.setLevel(LogLevels::INFO);
+        logSiteBindingHelper(first, 3);
+
+        // Other loggers are still checked against their own level.
+        Logger second;
+        second.addSink(&out, false, false);
+        second.setLevel(LogLevels::DEBUG);
+        logSiteBindingHelper(second, 4);
+        second.setLevel(LogLevels::WARN);
+        logSiteBindingHelper(second, 5);
+    }
+    // Destroyed loggers leave their sites unbound.
+    Logger third;
+    third.addSink(&out, false, false);
+    third.setLevel(LogLevels::DEBUG);
+    logSiteBindingHelper(third, 6);
+    third.setLevel(LogLevels::WARN);
+    logSiteBindingHelper(third, 7);
+
+    REQUIRE(countLines(out.str(), "binding debug") == 3);
+    for(int i : {2, 4, 6}) {
+        REQUIRE(countLines(out.str(), "binding debug " + std::to_string(i)) == 1);
+    }
+}
@@ -0,0 +1,70 @@
+#include "ObjectPool.hpp"
+
+#include <catch2/catch_all.hpp>
+
+using namespace core;
+
+struct Node
+{
+    size_t id;
+    String name;
+
+    Node(size_t id) : id(id), name(std::to_string(id)) {}
+};
+
+TEST_CASE("ObjectPool.Basic")
+{
+    MemoryManager mem("ObjectPool");
+    ObjectPool<Node, 64> pool(mem);
+
+    Vector<Node *> nodes;
+    for(size_t i = 0; i < 1000; ++i) nodes.push_back(pool.alloc(i));
+    REQUIRE(pool.size() == 1000);
+    REQUIRE(pool.capacity() == 1024);
+    // Free every other node, the slots get reused.
+    for(size_t i = 0; i < 1000; i += 2) pool.free(nodes[i]);
+    REQUIRE(pool.size() == 500);
+    for(size_t i = 0; i < 500; ++i) pool.alloc(1000 + i);
+    REQUIRE(pool.capacity() == 1024);
+
+    // Iteration is in memory order, and only covers the live objects.
+    size_t visited = 0, bad = 0;
+    Node *prev     = nullptr;
+    for(auto &node : pool) {
+        if(prev && prev >= &node) ++bad;
+        if(node.name != std::to_string(node.id)) ++bad;
+        prev = &node;
+        ++visited;
+    }
+    REQUIRE(bad == 0);
+    REQUIRE(visited == 1000);
+
+    pool.clear();
+    REQUIRE(pool.size() == 0);
+    REQUIRE(pool.begin() == pool.end());
+    pool.alloc(5);
+    REQUIRE(pool.begin()->id == 5);
+}
+
+TEST_CASE("ObjectPool.OutOfMemory")
+{
+    Path file = fs::temp_directory_path() / "LibCoreObjectPoolTest.heap";
+    fs::remove(file);
+    {
+        // The blocks come from a persistent manager, which cannot grow beyond its file.
+        MemoryManager mem("ObjectPool", file, 4 * 1024 * 1024);
+        REQUIRE(mem.isPersistent());
+        ObjectPool<Array<char, 1024>, 256> pool(mem);
+
+        Vector<Array<char, 1024> *> objs;
+        while(Array<char, 1024> *obj = pool.alloc()) objs.push_back(obj);
+        REQUIRE(!objs.empty());
+        REQUIRE(pool.size() == objs.size());
+        REQUIRE(pool.capacity() == objs.size());
+        // Freed slots are still handed out.
+        pool.free(objs.back());
+        REQUIRE(pool.alloc() == objs.back());
+        REQUIRE(pool.alloc() == nullptr);
+    }
+    fs::remove(file);
+}
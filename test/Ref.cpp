@@ -0,0 +1,98 @@
+#include "Ref.hpp"
+
+#include <catch2/catch_all.hpp>
+
+using namespace core;
+
+static Atomic<size_t> destroyed = 0;
+
+struct Shape : public IRefCounted
+{
+    int sides;
+
+    Shape(int sides) : sides(sides) {}
+    ~Shape() { ++destroyed; }
+};
+
+struct Square : public Shape
+{
+    Square() : Shape(4) {}
+};
+
+TEST_CASE("Ref.Basic")
+{
+    MemoryManager mem("Ref");
+    destroyed = 0;
+    {
+        Ref<Shape> a = makeRef<Shape>(mem, 3);
+        REQUIRE(a->sides == 3);
+        REQUIRE(a.getRefCount() == 1);
+        Ref<Shape> b = a;
+        REQUIRE(a.getRefCount() == 2);
+        REQUIRE(a == b);
+        // Moves don't touch the count.
+        Ref<Shape> c = std::move(b);
+        REQUIRE(b == nullptr);
+        REQUIRE(c.getRefCount() == 2);
+        // A new reference can be taken from the object itself.
+        Ref<Shape> d(c.get());
+        REQUIRE(d.getRefCount() == 3);
+        d.reset();
+        c = nullptr;
+        REQUIRE(a.getRefCount() == 1);
+        REQUIRE(destroyed == 0);
+
+        Ref<Shape> sq = makeRef<Square>(mem);
+        REQUIRE(sq->sides == 4);
+        a = sq;
+        REQUIRE(destroyed == 1);
+    }
+    REQUIRE(destroyed == 2);
+    REQUIRE(mem.stats().liveBytes == 0);
+}
+
+TEST_CASE("Ref.Threads")
+{
+    MemoryManager mem("Ref");
+    destroyed = 0;
+    Ref<Shape> shared = makeRef<Shape>(mem, 5);
+
+    Vector<Thread> threads;
+    for(size_t t = 0; t < 8; ++t) {
+        threads.emplace_back([copy = shared]() mutable {
+            for(size_t i = 0; i < 10000; ++i) {
+                Ref<Shape> tmp = copy;
+                Ref<Shape> moved(std::move(tmp));
+                copy = moved;
+            }
+        });
+    }
+    shared.reset();
+    for(auto &t : threads) t.join();
+    // The last thread to drop its reference freed the object.
+    REQUIRE(destroyed == 1);
+    mem.trim();
+    REQUIRE(mem.stats().liveBytes == 0);
+}
+
+TEST_CASE("Unique.Basic")
+{
+    MemoryManager mem("Unique");
+    destroyed = 0;
+    {
+        Unique<Shape> a = makeUnique<Square>(mem);
+        REQUIRE(a->sides == 4);
+        Unique<Shape> b = std::move(a);
+        REQUIRE(!a);
+        REQUIRE(b.getMemoryManager() == &mem);
+        b = makeUnique<Shape>(mem, 6);
+        REQUIRE(destroyed == 1);
+        Shape *raw = b.release();
+        REQUIRE(!b);
+        mem.freeDeinit(raw);
+        REQUIRE(destroyed == 2);
+        b = makeUnique<Shape>(mem, 7);
+    }
+    REQUIRE(destroyed == 3);
+    REQUIRE(mem.stats().liveBytes == 0);
+}
@@ -0,0 +1,23 @@
+// Turns a binary log written by a Logger (see Logger::setBinary()) into text.
+
+#include "Logger.hpp"
+
+using namespace core;
+
+int main(int argc, char **argv)
+{
+    if(argc < 2 || argc > 3 || (argc == 3 && StringRef(argv[2]) != "--color")) {
+        std::cerr << "Usage: " << argv[0] << " <binary log file> [--color]\n";
+        return 1;
+    }
+    IFStream in(argv[1], std::ios::binary);
+    if(!in) {
+        std::cerr << "Failed to open file: " << argv[1] << "\n";
+        return 1;
+    }
+    if(!decodeBinaryLog(in, std::cout, argc == 3)) {
+        std::cerr << "Invalid or truncated binary log: " << argv[1] << "\n";
+        return 1;
+    }
+    return 0;
+}